@@ -16,6 +16,7 @@ struct MyProgram {
             try FileManager.default.createDirectory(atPath: out_dir, withIntermediateDirectories: true, attributes: nil)
         }
         
+        // the temporary directory is deleted at every start, so decoded images are not stored in its frame cache
         let tmp_dir = out_dir + ".dngs/"
         // If it exists, delete a previously leftover temporary directory
         var isDirectory : ObjCBool = true
@@ -58,7 +59,7 @@ struct MyProgram {
             let output_bit_depth = "Native"
             
             // align+merge
-            let out_url = try perform_denoising(image_urls: image_urls, progress: progress, merging_algorithm: merging_algorithm, tile_size: tile_size, search_distance: search_distance, noise_reduction: noise_reduction, exposure_control: exposure_control, output_bit_depth: output_bit_depth, out_dir: out_dir, tmp_dir: tmp_dir)
+            let out_url = try perform_denoising(image_urls: image_urls, progress: progress, merging_algorithm: merging_algorithm, tile_size: tile_size, search_distance: search_distance, noise_reduction: noise_reduction, exposure_control: exposure_control, output_bit_depth: output_bit_depth, out_dir: out_dir, tmp_dir: tmp_dir, frame_cache: false)
            
             print("Image saved in:", out_url.relativePath)            
         }
@@ -62,7 +62,7 @@ let search_distance_dict = [
 
 
 /// Main function of the burst photo app.
-func perform_denoising(image_urls: [URL], progress: ProcessingProgress, merging_algorithm: String = "Fast", tile_size: String = "Medium", search_distance: String = "Medium", noise_reduction: Double = 13.0, exposure_control: String = "LinearFullRange", output_bit_depth: String = "Native", out_dir: String, tmp_dir: String) throws -> URL {
+func perform_denoising(image_urls: [URL], progress: ProcessingProgress, merging_algorithm: String = "Fast", tile_size: String = "Medium", search_distance: String = "Medium", noise_reduction: Double = 13.0, exposure_control: String = "LinearFullRange", output_bit_depth: String = "Native", out_dir: String, tmp_dir: String, frame_cache: Bool = true) throws -> URL {
     
     // Maximum size for the caches
     let textureCacheMaxSizeMB: Double = min(10_000.0,
@@ -74,6 +74,9 @@ func perform_denoising(image_urls: [URL], progress: ProcessingProgress, merging_
                                          0.15 * systemFreeDiskSpace(),
                                          max(4.0,
                                              2 * textureCacheMaxSizeMB/1000))
+    /// Decoded frames are several times larger than the compressed DNGs, so the on-disk frame cache is kept in a subdirectory with a limit of its own, which does not push the converted DNGs out of their folder.
+    let maxFrameCacheSizeGB: Double = min(10.0, 0.1 * systemFreeDiskSpace())
+    let frame_cache_dir = tmp_dir + "frames/"
     
     textureCache.totalCostLimit = Int(textureCacheMaxSizeMB)
     
@@ -115,7 +118,11 @@ func perform_denoising(image_urls: [URL], progress: ProcessingProgress, merging_
     // load images
     t = DispatchTime.now().uptimeNanoseconds
     print("Loading images...")
-    var (textures, mosaic_pattern_width, white_level, black_level, exposure_bias, ISO_exposure_time, color_factors) = try load_images(dng_urls, textureCache: textureCache)
+    // decoded images are only kept in the on-disk frame cache if tmp_dir outlives this run
+    if frame_cache {
+        try FileManager.default.createDirectory(atPath: frame_cache_dir, withIntermediateDirectories: true)
+    }
+    var (textures, mosaic_pattern_width, white_level, black_level, exposure_bias, ISO_exposure_time, color_factors, negatives) = try load_images(dng_urls, textureCache: textureCache, frame_cache_dir: frame_cache ? frame_cache_dir : nil)
     print("Time to load all images: ", Float(DispatchTime.now().uptimeNanoseconds - t) / 1_000_000_000)
     t = DispatchTime.now().uptimeNanoseconds
     DispatchQueue.main.async { progress.int += (convert_to_dng ? 10_000_000 : 20_000_000) }
@@ -256,44 +263,24 @@ func perform_denoising(image_urls: [URL], progress: ProcessingProgress, merging_
     let suffix_exposure_control = suffix_exposure_control_dict[exposure_control]!
 
     let out_filename = in_filename + suffix_merging + suffix_exposure_control + ".dng"
-    let out_path = (dng_converter_present ? tmp_dir : out_dir) + out_filename
-    var out_url = URL(fileURLWithPath: out_path)
-    
-    if convert_to_dng {
-        // Ensure reference texture exists on disk (may not if it existed in memory cache)
-        _ = try convert_raws_to_dngs([image_urls[ref_idx]], dng_converter_path, tmp_dir, NSCache<NSString, ImageCacheWrapper>())
-    }
+    let out_path = out_dir + out_filename
+    let out_url = URL(fileURLWithPath: out_path)
     
     // save the output image
-    try texture_to_dng(output_texture_uint16, ref_dng_url, out_url, (scale_to_16bit ? Int32(white_level_scaled) : -1))
-    
-    // check if dng converter is installed
-    if dng_converter_present {
-        let path_delete = out_dir + out_filename
-          
-        // delete dng file if an old version exists
-        if FileManager.default.fileExists(atPath: path_delete) {
-            try FileManager.default.removeItem(atPath: path_delete)
-        }
-        
-        // the dng converter is installed -> convert output DNG saved before with Adobe DNG Converter, which increases compatibility of the resulting DNG
-        let final_url = try convert_raws_to_dngs([out_url], dng_converter_path, out_dir, textureCache, override_cache: true)
-        
-        // Delete tmp version of final_url in the tmp dir
-        if FileManager.default.fileExists(atPath: out_path) {
-            try FileManager.default.removeItem(atPath: out_path)
-        }
-                   
-        // update out URL to new file
-        out_url = final_url[0]
-    }
+    // - the metadata of the reference image has been parsed when loading it, so the reference DNG does not have to exist on disk anymore, unless it was loaded from the on-disk frame cache without parsing it
+    // - the raw image is written with lossless JPEG compression, encoded in parallel tiles, so it does not have to be re-compressed with Adobe DNG Converter anymore
+    let ref_negative = try negatives[ref_idx] ?? DNGNegative(ref_dng_url)
+    try texture_to_dng(output_texture_uint16, ref_negative, out_url, (scale_to_16bit ? Int32(white_level_scaled) : -1), compression: dng_output_lossless_jpeg)
     print("Time to save final image: ", Float(DispatchTime.now().uptimeNanoseconds - t) / 1_000_000_000)
     print("")
     print("Total processing time for", textures.count, "images: ", Float(DispatchTime.now().uptimeNanoseconds - t0) / 1_000_000_000)
     print("")
     
-    // Ensure the disk dng cache does not go above the set limit
+    // Ensure the disk dng cache and the frame cache do not go above the set limits
     try trim_disk_cache(cache_dir: tmp_dir, to_max_size: maxDNGFolderSizeGB)
+    if frame_cache {
+        try trim_disk_cache(cache_dir: frame_cache_dir, to_max_size: maxFrameCacheSizeGB)
+    }
     
     return out_url
 }
@@ -0,0 +1,50 @@
+#include "dng_counting_allocator.h"
+#include "dng_auto_ptr.h"
+
+
+// memory block that reports to its allocator when it is released
+// - the memory itself is a block of the default allocator
+class dng_counted_block : public dng_memory_block {
+
+public:
+    dng_counted_block(uint32 size, dng_counting_allocator& allocator)
+        : dng_memory_block(size)
+        , block(gDefaultDNGMemoryAllocator.Allocate(size))
+        , allocator(allocator) {
+
+        SetBuffer(block->Buffer());
+    }
+
+    virtual ~dng_counted_block() {
+        allocator.release(LogicalSize());
+    }
+
+private:
+    AutoPtr<dng_memory_block> block;
+    dng_counting_allocator& allocator;
+};
+
+
+dng_counting_allocator::dng_counting_allocator()
+    : allocated(0)
+    , peak(0) {
+}
+
+
+dng_memory_block* dng_counting_allocator::Allocate(uint32 size) {
+
+    dng_memory_block* block = new dng_counted_block(size, *this);
+
+    // raise the high-water mark if no other thread has raised it further in the meantime
+    const uint64 now_allocated = (allocated += size);
+    uint64 previous_peak = peak;
+    while (now_allocated > previous_peak && !peak.compare_exchange_weak(previous_peak, now_allocated)) {
+    }
+
+    return block;
+}
+
+
+void dng_counting_allocator::release(uint64 size) {
+    allocated -= size;
+}
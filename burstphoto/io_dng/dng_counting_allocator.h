@@ -0,0 +1,38 @@
+#ifndef __dng_counting_allocator__
+#define __dng_counting_allocator__
+
+#include "dng_memory.h"
+
+#include <atomic>
+
+
+// memory allocator that keeps track of the number of bytes of the memory blocks allocated through it (Allocate, not Malloc)
+// - the memory is allocated like with the default allocator of the DNG SDK
+// - blocks can be allocated and released from several threads at the same time
+class dng_counting_allocator : public dng_memory_allocator {
+
+public:
+    dng_counting_allocator();
+
+    virtual dng_memory_block* Allocate(uint32 size);
+
+    // number of bytes currently allocated
+    uint64 bytes_allocated() const {
+        return allocated;
+    }
+
+    // largest number of bytes that have been allocated at the same time
+    uint64 high_water_mark() const {
+        return peak;
+    }
+
+    // called by the blocks of the allocator when they are released
+    void release(uint64 size);
+
+private:
+    std::atomic<uint64> allocated;
+    std::atomic<uint64> peak;
+};
+
+
+#endif
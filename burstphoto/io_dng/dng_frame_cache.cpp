@@ -0,0 +1,246 @@
+#include "dng_sdk_wrapper.h"
+#include "dng_fingerprint.h"
+#include "dng_utils.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+// cached frames are stored as a fixed-size header followed by the pixel values
+// - all values are stored in the byte order of the machine, the cache is never shared between machines
+// - the pixel values start at a page boundary, so that they can be mapped and uploaded to the GPU without copying or parsing
+static const char frame_cache_magic[8] = {'B', 'P', 'F', 'R', 'A', 'M', 'E', '1'};
+static const uint32 frame_cache_version = 1;
+static const uint32 frame_cache_alignment = 4096;
+
+// the largest supported mosaic pattern is 6x6 (X-Trans)
+static const int frame_cache_max_mosaic_pattern_width = 6;
+
+struct frame_cache_header {
+    char magic[8];
+    uint32 version;
+    uint32 header_size;
+    uint64 pixel_offset;
+    int32 width;
+    int32 height;
+    int32 bytes_per_row;
+    int32 mosaic_pattern_width;
+    int32 white_level;
+    int32 black_levels[frame_cache_max_mosaic_pattern_width * frame_cache_max_mosaic_pattern_width];
+    int32 exposure_bias;
+    float ISO_exposure_time;
+    float color_factors[3];
+};
+
+
+struct dng_cached_frame {
+    void* data;
+    size_t size;
+};
+
+
+// number of bytes at the start and at the end of a file that are included in its fingerprint
+// - the start contains the metadata of a dng image and the end the last tiles of the raw image, hashing the whole file would take longer than decoding it
+static const uint64 fingerprint_sample_size = 64 * 1024;
+
+
+// read exactly count bytes at an offset
+static bool read_fully(int file, void* data, size_t count, uint64 offset) {
+
+    char* bytes = (char*) data;
+    while (count > 0) {
+        const ssize_t bytes_read = pread(file, bytes, count, off_t(offset));
+        if (bytes_read <= 0) {
+            return false;
+        }
+        bytes += bytes_read;
+        count -= size_t(bytes_read);
+        offset += uint64(bytes_read);
+    }
+    return true;
+}
+
+
+// path of the cache entry of a dng image, derived from a fingerprint of its file identity, modification time, size and of the first and last bytes of its content
+// - the identity and the modification time change when the file is replaced or rewritten, also if its size and the sampled bytes stay the same
+// - returns an empty string if the image cannot be read
+static std::string cached_frame_path(const char* cache_dir, const char* in_path) {
+
+    const int file = open(in_path, O_RDONLY);
+    if (file < 0) {
+        return std::string();
+    }
+
+    struct stat file_info;
+    if (fstat(file, &file_info) != 0 || file_info.st_size <= 0) {
+        close(file);
+        return std::string();
+    }
+    const uint64 file_size = uint64(file_info.st_size);
+    const uint64 head_size = Min_uint64(file_size, fingerprint_sample_size);
+    const uint64 tail_size = Min_uint64(file_size - head_size, fingerprint_sample_size);
+
+    std::vector<char> samples(size_t(head_size + tail_size));
+    const bool success = read_fully(file, samples.data(), size_t(head_size), 0) &&
+                         read_fully(file, samples.data() + head_size, size_t(tail_size), file_size - tail_size);
+    close(file);
+    if (!success) {
+        return std::string();
+    }
+
+#ifdef __APPLE__
+    const struct timespec modification_time = file_info.st_mtimespec;
+#else
+    const struct timespec modification_time = file_info.st_mtim;
+#endif
+    const uint64 identity[4] = {uint64(file_info.st_dev), uint64(file_info.st_ino), uint64(modification_time.tv_sec), uint64(modification_time.tv_nsec)};
+
+    dng_md5_printer printer;
+    printer.Process(identity, sizeof(identity));
+    printer.Process(&file_size, sizeof(file_size));
+    printer.Process(samples.data(), uint32(samples.size()));
+
+    std::string path(cache_dir);
+    if (!path.empty() && path.back() != '/') {
+        path += '/';
+    }
+    path += printer.Result().ToUtf8HexString().Get();
+    path += ".frame";
+    return path;
+}
+
+
+dng_cached_frame* open_cached_frame(const char* cache_dir, const char* in_path, const void** pixel_bytes, int* width, int* height, int* bytes_per_row, int* mosaic_pattern_width, int* white_level, int* black_level, int* exposure_bias, float* ISO_exposure_time, float* color_factor_r, float* color_factor_g, float* color_factor_b) {
+
+    const std::string path = cached_frame_path(cache_dir, in_path);
+    if (path.empty()) {
+        return NULL;
+    }
+
+    const int file = open(path.c_str(), O_RDONLY);
+    if (file < 0) {
+        return NULL;
+    }
+
+    struct stat file_info;
+    if (fstat(file, &file_info) != 0 || uint64(file_info.st_size) < sizeof(frame_cache_header)) {
+        close(file);
+        return NULL;
+    }
+
+    const size_t size = size_t(file_info.st_size);
+    void* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+
+    // reject entries of other versions and entries that have been truncated
+    const frame_cache_header& header = *(const frame_cache_header*) data;
+    if (memcmp(header.magic, frame_cache_magic, sizeof(frame_cache_magic)) != 0 ||
+        header.version != frame_cache_version ||
+        header.header_size != sizeof(frame_cache_header) ||
+        header.width <= 0 || header.height <= 0 ||
+        header.bytes_per_row < header.width * int32(sizeof(uint16)) ||
+        header.mosaic_pattern_width <= 0 || header.mosaic_pattern_width > frame_cache_max_mosaic_pattern_width ||
+        header.pixel_offset < sizeof(frame_cache_header) ||
+        header.pixel_offset + uint64(header.height) * uint64(header.bytes_per_row) > uint64(size)) {
+        munmap(data, size);
+        return NULL;
+    }
+
+    *pixel_bytes = (const char*) data + header.pixel_offset;
+    *width = header.width;
+    *height = header.height;
+    *bytes_per_row = header.bytes_per_row;
+    *mosaic_pattern_width = header.mosaic_pattern_width;
+    *white_level = header.white_level;
+    for (int i = 0; i < header.mosaic_pattern_width * header.mosaic_pattern_width; i++) {
+        black_level[i] = header.black_levels[i];
+    }
+    *exposure_bias = header.exposure_bias;
+    *ISO_exposure_time = header.ISO_exposure_time;
+    *color_factor_r = header.color_factors[0];
+    *color_factor_g = header.color_factors[1];
+    *color_factor_b = header.color_factors[2];
+
+    // the pixel values are read once from front to back
+    madvise(data, size, MADV_SEQUENTIAL);
+
+    dng_cached_frame* frame = new dng_cached_frame;
+    frame->data = data;
+    frame->size = size;
+    return frame;
+}
+
+
+void close_cached_frame(dng_cached_frame* frame) {
+
+    if (frame != NULL) {
+        munmap(frame->data, frame->size);
+        delete frame;
+    }
+}
+
+
+int write_cached_frame(const char* cache_dir, const char* in_path, const void* pixel_bytes, int width, int height, int bytes_per_row, int mosaic_pattern_width, int white_level, const int* black_level, int exposure_bias, float ISO_exposure_time, float color_factor_r, float color_factor_g, float color_factor_b) {
+
+    if (width <= 0 || height <= 0 || bytes_per_row < width * int(sizeof(uint16)) ||
+        mosaic_pattern_width <= 0 || mosaic_pattern_width > frame_cache_max_mosaic_pattern_width) {
+        return 1;
+    }
+
+    const std::string path = cached_frame_path(cache_dir, in_path);
+    if (path.empty()) {
+        return 1;
+    }
+
+    // rows are stored without padding
+    frame_cache_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, frame_cache_magic, sizeof(frame_cache_magic));
+    header.version = frame_cache_version;
+    header.header_size = sizeof(frame_cache_header);
+    header.pixel_offset = frame_cache_alignment;
+    header.width = width;
+    header.height = height;
+    header.bytes_per_row = width * int32(sizeof(uint16));
+    header.mosaic_pattern_width = mosaic_pattern_width;
+    header.white_level = white_level;
+    for (int i = 0; i < mosaic_pattern_width * mosaic_pattern_width; i++) {
+        header.black_levels[i] = black_level[i];
+    }
+    header.exposure_bias = exposure_bias;
+    header.ISO_exposure_time = ISO_exposure_time;
+    header.color_factors[0] = color_factor_r;
+    header.color_factors[1] = color_factor_g;
+    header.color_factors[2] = color_factor_b;
+
+    // write to a temporary file first, so that a concurrent reader never sees an incomplete entry
+    const std::string temp_path = path + "." + std::to_string(getpid()) + ".tmp";
+    FILE* file = fopen(temp_path.c_str(), "wb");
+    if (file == NULL) {
+        return 1;
+    }
+
+    std::vector<char> padding(frame_cache_alignment - sizeof(frame_cache_header), 0);
+    bool success = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                   fwrite(padding.data(), padding.size(), 1, file) == 1;
+    for (int row = 0; success && row < height; row++) {
+        success = fwrite((const char*) pixel_bytes + size_t(row) * size_t(bytes_per_row), header.bytes_per_row, 1, file) == 1;
+    }
+    success = (fclose(file) == 0) && success;
+
+    if (!success || rename(temp_path.c_str(), path.c_str()) != 0) {
+        remove(temp_path.c_str());
+        return 1;
+    }
+    return 0;
+}
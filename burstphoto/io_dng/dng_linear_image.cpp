@@ -0,0 +1,143 @@
+#include "dng_linear_image.h"
+#include "dng_exceptions.h"
+#include "dng_pixel_buffer.h"
+#include "dng_tag_values.h"
+#include "dng_utils.h"
+
+#include <cstring>
+
+
+// position in a repeating pattern, also for positions before its origin
+static uint32 pattern_phase(int32 position, uint32 period) {
+    const int32 phase = position % int32(period);
+    return uint32(phase < 0 ? phase + int32(period) : phase);
+}
+
+
+dng_linear_image::dng_linear_image(const dng_rect& bounds, const dng_linearization_info& info, bool half_float, void* pixel_bytes, uint32 bytes_per_row, dng_perf_counters* counters)
+    : dng_image(bounds, 1, ttShort)
+    , half_float(half_float)
+    , pixel_bytes((uint8*) pixel_bytes)
+    , bytes_per_row(bytes_per_row)
+    , counters(counters)
+    , active(info.fActiveArea) {
+
+    // scale like the DNG SDK does when it builds the stage 2 image: the range between the largest black level and the white level maps to 1.0
+    const real64 range = info.fWhiteLevel[0] - info.MaxBlackLevel(0);
+    if (range <= 0.0) {
+        ThrowBadFormat();
+    }
+    const real64 scale = 1.0 / range;
+
+    // the linearization table is applied by the lookup of the scaled values
+    const uint16* table = info.fLinearizationTable.Get() ? info.fLinearizationTable->Buffer_uint16() : NULL;
+    const uint32 table_size = table ? info.fLinearizationTable->LogicalSize() / sizeof(uint16) : 0;
+    scaled_values.resize(0x10000);
+    for (uint32 value = 0; value < 0x10000; value++) {
+        scaled_values[value] = real32((table ? table[Min_uint32(value, table_size - 1)] : value) * scale);
+    }
+
+    pattern_rows = info.fBlackLevelRepeatRows;
+    pattern_cols = info.fBlackLevelRepeatCols;
+    pattern_black.resize(pattern_rows * pattern_cols);
+    for (uint32 row = 0; row < pattern_rows; row++) {
+        for (uint32 col = 0; col < pattern_cols; col++) {
+            pattern_black[row * pattern_cols + col] = real32(info.fBlackLevel[row][col][0] * scale);
+        }
+    }
+
+    // the deltas are only defined for the columns and rows of the active area
+    column_black.assign(active.W(), 0.0f);
+    if (info.fBlackDeltaH.Get()) {
+        const real64* delta = info.fBlackDeltaH->Buffer_real64();
+        for (uint32 col = 0; col < active.W(); col++) {
+            column_black[col] = real32(delta[col] * scale);
+        }
+    }
+    row_black.assign(active.H(), 0.0f);
+    if (info.fBlackDeltaV.Get()) {
+        const real64* delta = info.fBlackDeltaV->Buffer_real64();
+        for (uint32 row = 0; row < active.H(); row++) {
+            row_black[row] = real32(delta[row] * scale);
+        }
+    }
+}
+
+
+void dng_linear_image::DoGet(dng_pixel_buffer& /* buffer */) const {
+    ThrowProgramError("dng_linear_image is write-only");
+}
+
+
+void dng_linear_image::linearize_row(const uint16* samples, int32 row, int32 left, uint32 count, real32* black, uint8* destination) const {
+
+    // collect the black levels of the row first, so that the conversion below is a plain loop that the compiler can vectorize
+    const real32* pattern = &pattern_black[pattern_phase(row - active.t, pattern_rows) * pattern_cols];
+    uint32 phase = pattern_phase(left - active.l, pattern_cols);
+    for (uint32 j = 0; j < count; j++) {
+        black[j] = pattern[phase];
+        if (++phase == pattern_cols) {
+            phase = 0;
+        }
+    }
+
+    // add the deltas to the part of the row that is inside of the active area
+    if (row >= active.t && row < active.b) {
+        const real32 row_delta = row_black[row - active.t];
+        const int32 start = Max_int32(active.l, left);
+        const int32 end = Min_int32(active.r, left + int32(count));
+        for (int32 col = start; col < end; col++) {
+            black[col - left] += column_black[col - active.l] + row_delta;
+        }
+    }
+
+    const real32* values = scaled_values.data();
+    if (half_float) {
+        uint16* output = (uint16*) destination;
+        for (uint32 j = 0; j < count; j++) {
+            const real32 value = values[samples[j]] - black[j];
+            uint32 bits;
+            memcpy(&bits, &value, sizeof(bits));
+            output[j] = DNG_FloatToHalf(bits);
+        }
+    } else {
+        real32* output = (real32*) destination;
+        for (uint32 j = 0; j < count; j++) {
+            output[j] = values[samples[j]] - black[j];
+        }
+    }
+}
+
+
+void dng_linear_image::DoPut(const dng_pixel_buffer& buffer) {
+
+    const real64 start_time = counters != NULL ? TickTimeInSeconds() : 0.0;
+    const dng_rect& area = buffer.fArea;
+    const uint32 width = area.W();
+    const uint32 pixel_size = half_float ? sizeof(uint16) : sizeof(real32);
+
+    // decoders usually put rows of 16-bit samples, other layouts (e.g. 8-bit samples) are converted first
+    std::vector<uint16> converted;
+    const uint16* samples;
+    int32 row_step;
+    if (buffer.fPixelType == ttShort && buffer.fColStep == 1) {
+        samples = buffer.ConstPixel_uint16(area.t, area.l, buffer.fPlane);
+        row_step = buffer.fRowStep;
+    } else {
+        converted.resize(size_t(width) * area.H());
+        dng_pixel_buffer temp(area, 0, 1, ttShort, pcInterleaved, converted.data());
+        temp.CopyArea(buffer, area, buffer.fPlane, 0, 1);
+        samples = converted.data();
+        row_step = int32(width);
+    }
+
+    std::vector<real32> black(width);
+    for (int32 row = area.t; row < area.b; row++) {
+        uint8* destination = pixel_bytes + size_t(row - Bounds().t) * bytes_per_row + size_t(area.l - Bounds().l) * pixel_size;
+        linearize_row(samples + ptrdiff_t(row - area.t) * row_step, row, area.l, width, black.data(), destination);
+    }
+
+    if (counters != NULL) {
+        dng_perf_counters::AddTime(counters->fCopyNanoseconds, start_time);
+    }
+}
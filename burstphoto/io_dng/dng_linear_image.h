@@ -0,0 +1,52 @@
+#ifndef __dng_linear_image__
+#define __dng_linear_image__
+
+#include "dng_host.h"
+#include "dng_image.h"
+#include "dng_linearization_info.h"
+
+#include <vector>
+
+
+// write-only image that linearizes the raw tiles as they are decoded and stores them as floating point values in memory of the caller
+// - the DNG SDK decodes a raw image tile by tile and puts each tile into the image, so the linearization table, the black levels
+//   and the white level are applied while the decoded tile is still in the cache, without a second pass over the whole image
+// - black levels are taken per position of the black level pattern, including BlackLevelDeltaH and BlackLevelDeltaV
+// - black is 0.0 and white is 1.0, values below black are kept so that the noise of dark areas is not biased
+// - pixels outside of the active area (e.g. masked areas) are linearized with the black level pattern, but without the deltas
+// - the time it takes to convert the decoded tiles is added to the copy time of counters, if they are not NULL
+class dng_linear_image : public dng_image {
+
+public:
+    // half_float stores 16-bit floats instead of 32-bit floats, bytes_per_row is the distance of consecutive rows in pixel_bytes
+    dng_linear_image(const dng_rect& bounds, const dng_linearization_info& info, bool half_float, void* pixel_bytes, uint32 bytes_per_row, dng_perf_counters* counters = NULL);
+
+protected:
+    virtual void DoGet(dng_pixel_buffer& buffer) const;
+    virtual void DoPut(const dng_pixel_buffer& buffer);
+
+private:
+    // linearize a single row of 16-bit samples
+    void linearize_row(const uint16* samples, int32 row, int32 left, uint32 count, real32* black, uint8* destination) const;
+
+    const bool half_float;
+    uint8* const pixel_bytes;
+    const uint32 bytes_per_row;
+    dng_perf_counters* const counters;
+
+    // active area, the black level pattern and the deltas start at its top left corner
+    const dng_rect active;
+
+    // scaled linear values of all possible 16-bit samples
+    std::vector<real32> scaled_values;
+
+    // scaled black levels of the repeating pattern and the deltas of the columns and rows of the active area
+    uint32 pattern_rows;
+    uint32 pattern_cols;
+    std::vector<real32> pattern_black;
+    std::vector<real32> column_black;
+    std::vector<real32> row_black;
+};
+
+
+#endif
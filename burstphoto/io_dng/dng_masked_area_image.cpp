@@ -0,0 +1,102 @@
+#include "dng_masked_area_image.h"
+#include "dng_exceptions.h"
+#include "dng_pixel_buffer.h"
+#include "dng_utils.h"
+
+#include <cstring>
+
+
+dng_masked_area_image::dng_masked_area_image(dng_pixel_buffer& buffer, const dng_ifd& rawIFD, uint32 mosaic_pattern_width, dng_memory_allocator& allocator, dng_perf_counters* counters)
+    : dng_simple_image(buffer, allocator)
+    , masked_area_count(0)
+    , mosaic_pattern_width(mosaic_pattern_width)
+    , counters(counters) {
+
+    if (mosaic_pattern_width == 0 || mosaic_pattern_width > kMaxCFAPattern) {
+        ThrowProgramError("Unsupported mosaic pattern width");
+    }
+
+    // only keep masked areas that are inside of the image
+    for (uint32 i = 0; i < Min_uint32(rawIFD.fMaskedAreaCount, kMaxMaskedAreas); i++) {
+        const dng_rect area = rawIFD.fMaskedArea[i] & Bounds();
+        if (area.NotEmpty()) {
+            masked_areas[masked_area_count++] = area;
+        }
+    }
+
+    memset(sums, 0, sizeof(sums));
+    memset(counts, 0, sizeof(counts));
+}
+
+
+bool dng_masked_area_image::black_levels(double* black_levels) const {
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (masked_area_count == 0) {
+        return false;
+    }
+    for (uint32 i = 0; i < mosaic_pattern_width * mosaic_pattern_width; i++) {
+        black_levels[i] = counts[i] > 0 ? double(sums[i]) / double(counts[i]) : 0.0;
+    }
+    return true;
+}
+
+
+void dng_masked_area_image::DoPut(const dng_pixel_buffer& buffer) {
+
+    const real64 start_time = counters != NULL ? TickTimeInSeconds() : 0.0;
+    dng_simple_image::DoPut(buffer);
+    if (counters != NULL) {
+        dng_perf_counters::AddTime(counters->fCopyNanoseconds, start_time);
+    }
+
+    // sum the part of the tile that overlaps the masked areas, the pixel values have just been written and are read from the cache
+    uint64 tile_sums[kMaxCFAPattern * kMaxCFAPattern] = {0};
+    uint64 tile_counts[kMaxCFAPattern * kMaxCFAPattern] = {0};
+    bool overlaps = false;
+
+    for (uint32 i = 0; i < masked_area_count; i++) {
+
+        const dng_rect area = masked_areas[i] & buffer.fArea;
+        if (area.IsEmpty()) {
+            continue;
+        }
+        overlaps = true;
+
+        for (int32 row = area.t; row < area.b; row++) {
+
+            // sum each position of the pattern with its own accumulator, whole pattern widths at a time
+            const uint16* pixels = fBuffer.ConstPixel_uint16(row, area.l, 0);
+            const uint32 count = area.W();
+            uint64* row_sums = tile_sums + (row % mosaic_pattern_width) * mosaic_pattern_width;
+            uint64* row_counts = tile_counts + (row % mosaic_pattern_width) * mosaic_pattern_width;
+            const uint32 phase = area.l % mosaic_pattern_width;
+
+            uint64 accumulators[kMaxCFAPattern] = {0};
+            uint32 j = 0;
+            for (; j + mosaic_pattern_width <= count; j += mosaic_pattern_width) {
+                for (uint32 k = 0; k < mosaic_pattern_width; k++) {
+                    accumulators[k] += pixels[j + k];
+                }
+            }
+            for (; j < count; j++) {
+                accumulators[j % mosaic_pattern_width] += pixels[j];
+            }
+
+            for (uint32 k = 0; k < mosaic_pattern_width; k++) {
+                const uint32 position = (phase + k) % mosaic_pattern_width;
+                row_sums[position] += accumulators[k];
+                row_counts[position] += count / mosaic_pattern_width + (k < count % mosaic_pattern_width ? 1 : 0);
+            }
+        }
+    }
+
+    if (overlaps) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (uint32 i = 0; i < mosaic_pattern_width * mosaic_pattern_width; i++) {
+            sums[i] += tile_sums[i];
+            counts[i] += tile_counts[i];
+        }
+    }
+}
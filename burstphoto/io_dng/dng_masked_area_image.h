@@ -0,0 +1,42 @@
+#ifndef __dng_masked_area_image__
+#define __dng_masked_area_image__
+
+#include "dng_host.h"
+#include "dng_ifd.h"
+#include "dng_simple_image.h"
+
+#include <mutex>
+
+
+// image that stores the decoded pixel values in memory of the caller and sums the pixel values of the masked areas
+// - masked areas are strips of the sensor that are covered from light, their average is the black level of the image
+// - the masked areas are summed when a decoded tile is put into the image, while the tile is still in the cache,
+//   so only the pixels of the masked areas are visited and the image does not have to be read again
+// - the pixel values are summed separately for each position of the mosaic pattern, positions are counted from the top left corner of the image
+// - the time it takes to store the decoded tiles is added to the copy time of counters, if they are not NULL
+class dng_masked_area_image : public dng_simple_image {
+
+public:
+    dng_masked_area_image(dng_pixel_buffer& buffer, const dng_ifd& rawIFD, uint32 mosaic_pattern_width, dng_memory_allocator& allocator, dng_perf_counters* counters = NULL);
+
+    // average pixel value of each position of the mosaic pattern (index: col + mosaic_pattern_width * row)
+    // - returns false if the image has no masked areas
+    bool black_levels(double* black_levels) const;
+
+protected:
+    virtual void DoPut(const dng_pixel_buffer& buffer);
+
+private:
+    uint32 masked_area_count;
+    dng_rect masked_areas[kMaxMaskedAreas];
+    const uint32 mosaic_pattern_width;
+    dng_perf_counters* const counters;
+
+    // tiles are put into the image from several threads at the same time
+    mutable std::mutex mutex;
+    uint64 sums[kMaxCFAPattern * kMaxCFAPattern];
+    uint64 counts[kMaxCFAPattern * kMaxCFAPattern];
+};
+
+
+#endif
@@ -0,0 +1,54 @@
+#include "dng_mmap_stream.h"
+#include "dng_exceptions.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+dng_mmap_stream::dng_mmap_stream(const char* filename)
+    : dng_mmap_stream(map_file(filename)) {
+}
+
+
+dng_mmap_stream::dng_mmap_stream(const file_mapping& mapping)
+    : dng_stream(mapping.data, uint32(mapping.size))
+    , mapping(mapping) {
+}
+
+
+dng_mmap_stream::~dng_mmap_stream() {
+    munmap(mapping.data, mapping.size);
+}
+
+
+dng_mmap_stream::file_mapping dng_mmap_stream::map_file(const char* filename) {
+
+    const int file = open(filename, O_RDONLY);
+    if (file < 0) {
+        ThrowOpenFile();
+    }
+
+    // the base stream addresses its memory with 32-bit sizes
+    struct stat file_info;
+    if (fstat(file, &file_info) != 0 || file_info.st_size <= 0 || uint64(file_info.st_size) > 0xFFFFFFFF) {
+        close(file);
+        ThrowOpenFile();
+    }
+
+    file_mapping mapping;
+    mapping.size = uint64(file_info.st_size);
+    mapping.data = mmap(NULL, mapping.size, PROT_READ, MAP_PRIVATE, file, 0);
+
+    // the mapping stays valid after the file descriptor is closed
+    close(file);
+    if (mapping.data == MAP_FAILED) {
+        ThrowOpenFile();
+    }
+
+    // the tiles of a raw image are mostly read front to back
+    madvise(mapping.data, mapping.size, MADV_SEQUENTIAL);
+
+    return mapping;
+}
@@ -0,0 +1,31 @@
+#ifndef __dng_mmap_stream__
+#define __dng_mmap_stream__
+
+#include "dng_stream.h"
+
+
+// read-only stream on a memory-mapped file
+// - the whole file is exposed as one memory block, so Get() copies straight from the mapping and Data() returns
+//   a pointer to it, which lets the DNG SDK decode tiles without copying them to intermediate buffers first
+// - throws a dng_exception if the file cannot be mapped (e.g. empty files or files larger than 4 GB)
+class dng_mmap_stream : public dng_stream {
+
+public:
+    explicit dng_mmap_stream(const char* filename);
+    virtual ~dng_mmap_stream();
+
+private:
+    struct file_mapping {
+        void* data;
+        uint64 size;
+    };
+
+    static file_mapping map_file(const char* filename);
+
+    explicit dng_mmap_stream(const file_mapping& mapping);
+
+    const file_mapping mapping;
+};
+
+
+#endif
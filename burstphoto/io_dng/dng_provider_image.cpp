@@ -0,0 +1,42 @@
+#include "dng_provider_image.h"
+#include "dng_exceptions.h"
+#include "dng_pixel_buffer.h"
+#include "dng_tag_values.h"
+
+#include <vector>
+
+
+dng_provider_image::dng_provider_image(const dng_rect& bounds, uint32 planes, uint32 pixel_type, dng_pixel_area_provider provide_pixels, void* context)
+    : dng_image(bounds, planes, pixel_type)
+    , provide_pixels(provide_pixels)
+    , context(context) {
+}
+
+
+void dng_provider_image::DoGet(dng_pixel_buffer& buffer) const {
+
+    const dng_rect& area = buffer.fArea;
+
+    // let the callback write directly into the buffer if it has the layout of interleaved rows
+    if (buffer.fPixelType == PixelType() &&
+        buffer.fPlane == 0 && buffer.fPlanes == Planes() &&
+        buffer.fColStep == int32(Planes()) && (Planes() == 1 || buffer.fPlaneStep == 1) &&
+        buffer.fRowStep > 0) {
+
+        provide_pixels(context, area.l, area.t, area.W(), area.H(), buffer.fData, buffer.fRowStep * buffer.fPixelSize);
+        return;
+    }
+
+    // otherwise, request all planes of the area and copy the requested ones
+    const uint32 bytes_per_row = area.W() * Planes() * PixelSize();
+    std::vector<uint8> pixel_bytes(size_t(bytes_per_row) * area.H());
+    provide_pixels(context, area.l, area.t, area.W(), area.H(), pixel_bytes.data(), bytes_per_row);
+
+    dng_pixel_buffer interleaved(area, 0, Planes(), PixelType(), pcInterleaved, pixel_bytes.data());
+    buffer.CopyArea(interleaved, area, buffer.fPlane, buffer.fPlane, buffer.fPlanes);
+}
+
+
+void dng_provider_image::DoPut(const dng_pixel_buffer& /* buffer */) {
+    ThrowProgramError("dng_provider_image is read-only");
+}
@@ -0,0 +1,27 @@
+#ifndef __dng_provider_image__
+#define __dng_provider_image__
+
+#include "dng_image.h"
+#include "dng_sdk_wrapper.h"
+
+
+// read-only image that requests its pixel values from a callback whenever an area is read
+// - the DNG SDK reads the raw image tile by tile while it encodes and hashes it, so the pixel values can be copied
+//   straight from where they are produced (e.g. a texture) into the buffers of the encoder without staging a copy of the whole image
+// - the pixel values are passed to the callback as interleaved rows, the callback may be called from several threads at the same time
+class dng_provider_image : public dng_image {
+
+public:
+    dng_provider_image(const dng_rect& bounds, uint32 planes, uint32 pixel_type, dng_pixel_area_provider provide_pixels, void* context);
+
+protected:
+    virtual void DoGet(dng_pixel_buffer& buffer) const;
+    virtual void DoPut(const dng_pixel_buffer& buffer);
+
+private:
+    const dng_pixel_area_provider provide_pixels;
+    void* const context;
+};
+
+
+#endif
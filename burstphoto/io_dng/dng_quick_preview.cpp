@@ -0,0 +1,205 @@
+#include "dng_quick_preview.h"
+#include "dng_area_task.h"
+#include "dng_color_space.h"
+#include "dng_date_time.h"
+#include "dng_image_writer.h"
+#include "dng_linearization_info.h"
+#include "dng_mosaic_info.h"
+#include "dng_pixel_buffer.h"
+#include "dng_render.h"
+#include "dng_resample.h"
+#include "dng_simple_image.h"
+#include "dng_tag_values.h"
+#include "dng_utils.h"
+
+#include <vector>
+
+
+// sizes of the long edges of the preview and the thumbnail
+static const uint32 preview_size = 1024;
+static const uint32 thumbnail_size = 256;
+
+
+// bin a linearized mosaic into whole CFA cells
+// - every pixel of the binned image averages the samples of each color in a block of bin_size CFA cells
+// - the result is scaled like a stage 3 image: black is 0, white is 65535
+class dng_bin_mosaic_task : public dng_area_task {
+
+public:
+    dng_bin_mosaic_task(const dng_image& raw, const dng_linearization_info& info, const dng_point& pattern_size, const uint32* plane_of_pattern, const dng_point& cell_size, dng_simple_image& binned)
+        : dng_area_task("dng_bin_mosaic_task")
+        , raw(raw)
+        , info(info)
+        , pattern_size(pattern_size)
+        , plane_of_pattern(plane_of_pattern)
+        , cell_size(cell_size)
+        , binned(binned) {
+
+        fMinTaskArea = 256 * 256;
+        white_scale = 65535.0 / Max_real64(info.fWhiteLevel[0] - info.MaxBlackLevel(0), 1.0);
+    }
+
+    virtual void Process(uint32 /* thread_index */, const dng_rect& tile, dng_abort_sniffer* /* sniffer */) {
+
+        // read the raw samples covered by the tile
+        const dng_rect& active = info.fActiveArea;
+        const dng_rect source(active.t + tile.t * cell_size.v, active.l + tile.l * cell_size.h,
+                              active.t + tile.b * cell_size.v, active.l + tile.r * cell_size.h);
+        std::vector<uint16> samples(size_t(source.W()) * source.H());
+        dng_pixel_buffer buffer(source, 0, 1, ttShort, pcInterleaved, samples.data());
+        raw.Get(buffer);
+
+        const uint16* table = info.fLinearizationTable.Get() ? info.fLinearizationTable->Buffer_uint16() : NULL;
+        const uint32 table_size = table ? info.fLinearizationTable->LogicalSize() / sizeof(uint16) : 0;
+        const real64* delta_h = info.fBlackDeltaH.Get() ? info.fBlackDeltaH->Buffer_real64() : NULL;
+        const real64* delta_v = info.fBlackDeltaV.Get() ? info.fBlackDeltaV->Buffer_real64() : NULL;
+        const uint32 planes = binned.Planes();
+
+        for (int32 row = tile.t; row < tile.b; row++) {
+            for (int32 col = tile.l; col < tile.r; col++) {
+
+                real64 sums[kMaxColorPlanes] = {0.0};
+                uint32 counts[kMaxColorPlanes] = {0};
+
+                // positions relative to the active area, where the CFA and black level patterns start
+                for (int32 y = row * cell_size.v; y < (row + 1) * cell_size.v; y++) {
+                    const uint16* sample = &samples[size_t(y - tile.t * cell_size.v) * source.W() + size_t(col - tile.l) * cell_size.h];
+
+                    for (int32 x = col * cell_size.h; x < (col + 1) * cell_size.h; x++, sample++) {
+
+                        real64 value = table ? table[Min_uint32(*sample, table_size - 1)] : *sample;
+                        value -= info.fBlackLevel[y % info.fBlackLevelRepeatRows][x % info.fBlackLevelRepeatCols][0];
+                        if (delta_h) {value -= delta_h[x];}
+                        if (delta_v) {value -= delta_v[y];}
+
+                        const uint32 plane = plane_of_pattern[(y % pattern_size.v) * kMaxCFAPattern + (x % pattern_size.h)];
+                        sums[plane] += value;
+                        counts[plane]++;
+                    }
+                }
+
+                for (uint32 plane = 0; plane < planes; plane++) {
+                    const real64 value = counts[plane] > 0 ? sums[plane] / counts[plane] * white_scale : 0.0;
+                    *binned.fBuffer.DirtyPixel_uint16(row, col, plane) = uint16(Pin_real64(0.0, value + 0.5, 65535.0));
+                }
+            }
+        }
+    }
+
+private:
+    const dng_image& raw;
+    const dng_linearization_info& info;
+    const dng_point pattern_size;
+    const uint32* const plane_of_pattern;
+    const dng_point cell_size;
+    dng_simple_image& binned;
+    real64 white_scale;
+};
+
+
+// render the stage 3 image of a negative at a reduced size in sRGB (or gray gamma 2.2)
+static dng_image* render_preview_image(dng_host& host, const dng_negative& negative, uint32 maximum_size) {
+
+    dng_render render(host, negative);
+    render.SetFinalSpace(negative.IsMonochrome() ? dng_space_GrayGamma22::Get() : dng_space_sRGB::Get());
+    render.SetFinalPixelType(ttByte);
+    render.SetMaximumSize(maximum_size);
+    return render.Render();
+}
+
+
+void append_quick_previews(dng_host& host, dng_negative& negative, dng_preview_list& previews) {
+
+    const dng_image& raw = *negative.Stage1Image();
+    const dng_linearization_info* info = negative.GetLinearizationInfo();
+    const dng_mosaic_info* mosaic = negative.GetMosaicInfo();
+    if (info == NULL || raw.Planes() != 1 || raw.PixelType() != ttShort) {
+        return;
+    }
+
+    // map the positions of the CFA pattern to color planes, a monochrome image is a pattern with a single plane
+    dng_point pattern_size(1, 1);
+    uint32 planes = 1;
+    uint32 plane_of_pattern[kMaxCFAPattern * kMaxCFAPattern] = {0};
+    if (mosaic != NULL && mosaic->IsColorFilterArray()) {
+        pattern_size = mosaic->fCFAPatternSize;
+        planes = mosaic->fColorPlanes;
+        for (int32 y = 0; y < pattern_size.v; y++) {
+            for (int32 x = 0; x < pattern_size.h; x++) {
+                for (uint32 plane = 0; plane < planes; plane++) {
+                    if (mosaic->fCFAPlaneColor[plane] == mosaic->fCFAPattern[y][x]) {
+                        plane_of_pattern[y * kMaxCFAPattern + x] = plane;
+                    }
+                }
+            }
+        }
+    } else if (!negative.IsMonochrome()) {
+        return;
+    }
+
+    // bin blocks of whole CFA cells, so that every binned pixel contains all colors
+    const dng_rect& active = info->fActiveArea;
+    const uint32 cells_across = active.W() / pattern_size.h;
+    const uint32 cells_down = active.H() / pattern_size.v;
+    // - the binned image is between one and two times as large as the preview, dng_render downsamples it to the final size
+    const uint32 bin_size = Max_uint32(1, Max_uint32(cells_across, cells_down) / preview_size);
+    const dng_point cell_size(pattern_size.v * bin_size, pattern_size.h * bin_size);
+    const dng_rect binned_bounds(active.H() / cell_size.v, active.W() / cell_size.h);
+    if (binned_bounds.IsEmpty()) {
+        return;
+    }
+
+    dng_simple_image* binned = new dng_simple_image(binned_bounds, planes, ttShort, host.Allocator());
+    AutoPtr<dng_image> stage3(binned);
+    dng_bin_mosaic_task task(raw, *info, pattern_size, plane_of_pattern, cell_size, *binned);
+    host.PerformAreaTask(task, binned_bounds);
+
+    // render the previews from the binned image, which is one pixel per cell of the full-size stage 3 image
+    const real64 original_scale_h = negative.RawToFullScaleH();
+    const real64 original_scale_v = negative.RawToFullScaleV();
+    negative.SetRawToFullScale(1.0 / cell_size.h, 1.0 / cell_size.v);
+    negative.SetStage3Image(stage3);
+
+    AutoPtr<dng_image> preview_image;
+    try {
+        preview_image.Reset(render_preview_image(host, negative, preview_size));
+    } catch (...) {
+        negative.fStage3Image.Reset();
+        negative.SetRawToFullScale(original_scale_h, original_scale_v);
+        throw;
+    }
+    negative.fStage3Image.Reset();
+    negative.SetRawToFullScale(original_scale_h, original_scale_v);
+
+    // the thumbnail is downsampled from the rendered preview
+    const dng_rect& preview_bounds = preview_image->Bounds();
+    const real64 thumbnail_scale = Min_real64(1.0, real64(thumbnail_size) / Max_uint32(preview_bounds.W(), preview_bounds.H()));
+    const dng_rect thumbnail_bounds(Max_uint32(1, Round_uint32(preview_bounds.H() * thumbnail_scale)),
+                                    Max_uint32(1, Round_uint32(preview_bounds.W() * thumbnail_scale)));
+    AutoPtr<dng_image> thumbnail_image(new dng_simple_image(thumbnail_bounds, preview_image->Planes(), ttByte, host.Allocator()));
+    ResampleImage(host, *preview_image, *thumbnail_image, preview_bounds, thumbnail_bounds, dng_resample_bicubic::Get());
+
+    dng_date_time_info date_time;
+    CurrentDateTimeAndZone(date_time);
+
+    // the thumbnail is stored uncompressed, the preview as a JPEG, like Adobe DNG Converter does
+    for (uint32 index = 0; index < 2; index++) {
+
+        AutoPtr<dng_image>& image = index == 0 ? thumbnail_image : preview_image;
+        AutoPtr<dng_preview> preview(index == 0 ? (dng_preview*) new dng_image_preview : (dng_preview*) new dng_jpeg_preview);
+
+        preview->fInfo.fApplicationName.Set("Burst Photo");
+        preview->fInfo.fSettingsName.Set("Default");
+        preview->fInfo.fColorSpace = image->Planes() == 1 ? previewColorSpace_GrayGamma22 : previewColorSpace_sRGB;
+        preview->fInfo.fDateTime = date_time.Encode_ISO_8601();
+
+        if (index == 0) {
+            ((dng_image_preview*) preview.Get())->SetImage(image.Release());
+        } else {
+            dng_image_writer writer;
+            writer.EncodeJPEGPreview(host, *image, *(dng_jpeg_preview*) preview.Get(), 5);
+        }
+
+        previews.Append(preview);
+    }
+}
@@ -0,0 +1,18 @@
+#ifndef __dng_quick_preview__
+#define __dng_quick_preview__
+
+#include "dng_host.h"
+#include "dng_negative.h"
+#include "dng_preview.h"
+
+
+// render a thumbnail (256 pixels, uncompressed) and a preview (1024 pixels, JPEG) of the stage 1 image of a negative
+// - instead of the full linearization and demosaicing pipeline of the DNG SDK, the mosaic is binned into whole CFA cells,
+//   which yields a small linear RGB image in one pass over the raw data that is rendered with dng_render and downsampled with dng_resample
+// - opcode lists are not applied to the previews
+// - the stage 3 image of the negative is only set while rendering, it is removed again before returning
+// - nothing is appended for raw images that are neither CFA nor monochrome images
+void append_quick_previews(dng_host& host, dng_negative& negative, dng_preview_list& previews);
+
+
+#endif
@@ -0,0 +1,154 @@
+#include "dng_read_ahead_stream.h"
+#include "dng_utils.h"
+
+#include <cstring>
+
+
+dng_read_ahead_stream::dng_read_ahead_stream(const char* filename, uint32 depth)
+    : dng_file_stream(filename)
+    , depth(Max_uint32(depth, 1))
+    , slot_size(0)
+    , first_unconsumed_tile(0)
+    , stopping(false) {
+}
+
+
+dng_read_ahead_stream::~dng_read_ahead_stream() {
+    EndTileReads();
+}
+
+
+void dng_read_ahead_stream::BeginTileReads(uint32 tile_count, const uint64* tile_offset, const uint32* tile_byte_count) {
+
+    EndTileReads();
+    if (tile_count == 0) {
+        return;
+    }
+
+    tile_offsets.assign(tile_offset, tile_offset + tile_count);
+    tile_byte_counts.assign(tile_byte_count, tile_byte_count + tile_count);
+    tile_states.assign(tile_count, tile_pending);
+    for (uint32 i = 0; i < tile_count; i++) {
+        // tiles that share their data with an earlier tile (e.g. one blank tile written for several tiles) are not prefetched,
+        // the offset maps to the first of them and the others are read from the file, so they must not hold back first_unconsumed_tile
+        if (!tile_indices.insert(std::make_pair(tile_offset[i], i)).second) {
+            tile_states[i] = tile_consumed;
+            continue;
+        }
+        slot_size = Max_uint32(slot_size, tile_byte_count[i]);
+    }
+    slots.resize(size_t(slot_size) * Min_uint32(depth, tile_count));
+
+    first_unconsumed_tile = 0;
+    stopping = false;
+    read_ahead_thread = std::thread(&dng_read_ahead_stream::read_ahead_loop, this);
+}
+
+
+void dng_read_ahead_stream::EndTileReads() {
+
+    if (read_ahead_thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        slot_released_condition.notify_all();
+        read_ahead_thread.join();
+    }
+
+    tile_offsets.clear();
+    tile_byte_counts.clear();
+    tile_indices.clear();
+    tile_states.clear();
+    std::vector<uint8>().swap(slots);
+    slot_size = 0;
+}
+
+
+void dng_read_ahead_stream::read_ahead_loop() {
+
+    for (uint32 i = 0; i < tile_states.size(); i++) {
+
+        // wait until the tile that used the slot before has been read from the stream
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            slot_released_condition.wait(lock, [&] { return stopping || i < first_unconsumed_tile + depth; });
+            if (stopping) {
+                return;
+            }
+            if (tile_states[i] == tile_consumed) {
+                continue;
+            }
+        }
+
+        // the slot is not accessed by any other thread until the tile is marked as loaded
+        tile_state state = tile_loaded;
+        try {
+            dng_file_stream::DoReadAt(&slots[size_t(i % depth) * slot_size], tile_byte_counts[i], tile_offsets[i]);
+        } catch (...) {
+            state = tile_failed;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tile_states[i] = state;
+        }
+        tile_loaded_condition.notify_all();
+    }
+}
+
+
+// copy a tile from its slot if the read matches a prefetched tile
+// - returns false if the data has to be read from the file instead
+bool dng_read_ahead_stream::read_from_cache(void* data, uint32 count, uint64 offset) {
+
+    std::unique_lock<std::mutex> lock(mutex);
+
+    std::map<uint64, uint32>::const_iterator match = tile_indices.find(offset);
+    if (match == tile_indices.end()) {
+        return false;
+    }
+    const uint32 index = match->second;
+    if (count != tile_byte_counts[index] || tile_states[index] == tile_consumed) {
+        return false;
+    }
+
+    // tiles whose slot is still used by an earlier tile are read from the file and skipped by the background thread
+    // - waiting for them could depend on an earlier tile that is never read
+    bool loaded = false;
+    if (tile_states[index] != tile_pending || index < first_unconsumed_tile + depth) {
+        tile_loaded_condition.wait(lock, [&] { return tile_states[index] != tile_pending; });
+        loaded = tile_states[index] == tile_loaded;
+    }
+    if (loaded) {
+        lock.unlock();
+        memcpy(data, &slots[size_t(index % depth) * slot_size], count);
+        lock.lock();
+    }
+
+    // release the slot
+    tile_states[index] = tile_consumed;
+    while (first_unconsumed_tile < tile_states.size() && tile_states[first_unconsumed_tile] == tile_consumed) {
+        first_unconsumed_tile++;
+    }
+    lock.unlock();
+    slot_released_condition.notify_all();
+
+    return loaded;
+}
+
+
+void dng_read_ahead_stream::DoRead(void* data, uint32 count, uint64 offset) {
+
+    if (!read_from_cache(data, count, offset)) {
+        dng_file_stream::DoRead(data, count, offset);
+    }
+}
+
+
+void dng_read_ahead_stream::DoReadAt(void* data, uint32 count, uint64 offset) {
+
+    if (!read_from_cache(data, count, offset)) {
+        dng_file_stream::DoReadAt(data, count, offset);
+    }
+}
@@ -0,0 +1,64 @@
+#ifndef __dng_read_ahead_stream__
+#define __dng_read_ahead_stream__
+
+#include "dng_file_stream.h"
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+// file stream that reads the tiles of an image on a background thread before they are requested
+// - the DNG SDK announces the byte ranges of the tiles with BeginTileReads() before reading them
+// - at most depth tiles are held in memory, a tile is released as soon as it has been read from the stream
+// - reads that do not match a prefetched tile go to the file directly
+// - this helps when the file is on a slow or high-latency volume (e.g. network storage), for local files
+//   dng_mmap_stream is usually the better choice
+class dng_read_ahead_stream : public dng_file_stream {
+
+public:
+    explicit dng_read_ahead_stream(const char* filename, uint32 depth = 32);
+    virtual ~dng_read_ahead_stream();
+
+    virtual void BeginTileReads(uint32 tile_count, const uint64* tile_offset, const uint32* tile_byte_count);
+    virtual void EndTileReads();
+
+protected:
+    virtual void DoRead(void* data, uint32 count, uint64 offset);
+    virtual void DoReadAt(void* data, uint32 count, uint64 offset);
+
+private:
+    enum tile_state {
+        tile_pending,
+        tile_loaded,
+        tile_failed,
+        tile_consumed
+    };
+
+    bool read_from_cache(void* data, uint32 count, uint64 offset);
+    void read_ahead_loop();
+
+    const uint32 depth;
+
+    std::vector<uint64> tile_offsets;
+    std::vector<uint32> tile_byte_counts;
+    std::map<uint64, uint32> tile_indices;
+
+    // tile i is stored in slot i % depth
+    std::vector<uint8> slots;
+    uint32 slot_size;
+
+    std::mutex mutex;
+    std::condition_variable tile_loaded_condition;
+    std::condition_variable slot_released_condition;
+    std::vector<tile_state> tile_states;
+    uint32 first_unconsumed_tile;
+    bool stopping;
+
+    std::thread read_ahead_thread;
+};
+
+
+#endif
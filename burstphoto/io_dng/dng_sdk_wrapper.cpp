@@ -1,22 +1,246 @@
 #include "dng_sdk_wrapper.h"
+#include "dng_counting_allocator.h"
 #include "dng_exceptions.h"
 #include "dng_file_stream.h"
 #include "dng_host.h"
 #include "dng_ifd.h"
 #include "dng_image_writer.h"
 #include "dng_info.h"
+#include "dng_linear_image.h"
+#include "dng_masked_area_image.h"
+#include "dng_mmap_stream.h"
 #include "dng_negative.h"
+#include "dng_provider_image.h"
+#include "dng_quick_preview.h"
+#include "dng_read_ahead_stream.h"
+#include "dng_simd_type.h"
 #include "dng_simple_image.h"
+#include "dng_threaded_host.h"
+#include "dng_utils.h"
 #include "dng_xmp_sdk.h"
 
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __APPLE__
+#include <sys/mount.h>
+#endif
+
+
+// best instruction set of the CPU that the DNG SDK has code for, the SDK leaves the detection to the host
+static SIMDType max_simd_type() {
+#if qDNGHasAVX2 && (defined(__GNUC__) || defined(__clang__))
+    return __builtin_cpu_supports("avx2") ? AVX2 : SSE2;
+#elif qDNGHasSSE2
+    return SSE2;
+#elif qDNGHasNEON
+    return arm64_neon;
+#else
+    return Scalar;
+#endif
+}
+
 
 void initialize_xmp_sdk() {
+#if qDNGUseXMP
     dng_xmp_sdk::InitializeSDK();
+#endif
+    
+    // the predictors of deflate compressed files are decoded and encoded with vector instructions up to this level
+    gDNGMaxSIMD = max_simd_type();
+    
+    // the worker threads that decode and encode tiles are started once and shared by all files
+    dng_thread_pool::initialize_shared();
 }
 
 
 void terminate_xmp_sdk() {
+    dng_thread_pool::terminate_shared();
+#if qDNGUseXMP
     dng_xmp_sdk::TerminateSDK();
+#endif
+}
+
+
+// read the metadata of the raw image that is required for merging
+// - masked_area_black_levels are the black levels measured in the masked areas of the decoded image (NULL if they are not available),
+//   they replace black levels of 0 reported by the image
+static int read_raw_metadata(dng_negative& negative, const dng_ifd& rawIFD, const double* masked_area_black_levels, int* mosaic_pattern_width, int* white_level, int* black_levels, int* masked_areas, int* exposure_bias, float* ISO_exposure_time, float* color_factor_r, float* color_factor_g, float* color_factor_b) {
+    
+    // get size of mosaic pattern
+    // - this affects how raw pixels are aligned
+    // - it is assumed that the pattern is square
+    const dng_mosaic_info* mosaic_info = negative.GetMosaicInfo();
+    if (mosaic_info == NULL) {
+        *mosaic_pattern_width = 1;
+        printf("ERROR: MosaicInfo is null.\n");
+        return 1;
+    } else {
+        dng_point mosaic_pattern_size = negative.fMosaicInfo->fCFAPatternSize;
+        *mosaic_pattern_width = mosaic_pattern_size.h;
+    }
+           
+    // Get masked area
+    if (rawIFD.fMaskedAreaCount > 0) {
+        for (int i = 0; i < rawIFD.fMaskedAreaCount; i++) {
+            // Add masked areas to the array
+            *(masked_areas + 4*i + 0) = rawIFD.fMaskedArea[i].t;
+            *(masked_areas + 4*i + 1) = rawIFD.fMaskedArea[i].l;
+            *(masked_areas + 4*i + 2) = rawIFD.fMaskedArea[i].b;
+            *(masked_areas + 4*i + 3) = rawIFD.fMaskedArea[i].r;
+        }
+    }
+    
+    int mosaic_width = *mosaic_pattern_width;
+    // Get black level, white level and color factors for exposure correction
+    const dng_linearization_info* linearization_info = negative.GetLinearizationInfo();
+    if (linearization_info == NULL) {
+        printf("ERROR: LinearizationInfo is null.\n");
+        return 1;
+    } else {
+        *white_level = int(linearization_info->fWhiteLevel[0]);
+        
+        // The following performs basic handling of fBlackDeltaV and fBlackDeltaH
+        // It is not fully correct, and will fail if each row and column have significant differences between black levels.
+        // The current support is added to allow for certain older canon cameras (e.g. Canon 350D) to work correctly since they rely on it.
+        double black_level_delta_adjust[6*6] = { 0 };
+        
+        // average the deltas of the rows and of the columns that belong to each row and column of the mosaic pattern
+        // - the rows and columns are averaged separately, so that the average of the rows is not divided by the number of columns
+        double row_delta_adjust[6] = { 0 };
+        double col_delta_adjust[6] = { 0 };
+        
+        if (linearization_info->RowBlackCount() > 0) {
+            int row_count[6] = { 0 };
+            for (int row = 0; row < linearization_info->RowBlackCount(); row++) {
+                row_delta_adjust[row % mosaic_width] += linearization_info->fBlackDeltaV->Buffer_real64()[row];
+                row_count[row % mosaic_width]++;
+            }
+            for (int i = 0; i < mosaic_width; i++) {
+                row_delta_adjust[i] /= Max_int32(row_count[i], 1);
+            }
+        }
+        
+        if (linearization_info->ColumnBlackCount() > 0) {
+            int col_count[6] = { 0 };
+            for (int col = 0; col < linearization_info->ColumnBlackCount(); col++) {
+                col_delta_adjust[col % mosaic_width] += linearization_info->fBlackDeltaH->Buffer_real64()[col];
+                col_count[col % mosaic_width]++;
+            }
+            for (int i = 0; i < mosaic_width; i++) {
+                col_delta_adjust[i] /= Max_int32(col_count[i], 1);
+            }
+        }
+        
+        for (int row = 0; row < mosaic_width; row++) {
+            for (int col = 0; col < mosaic_width; col++) {
+                black_level_delta_adjust[row + col * mosaic_width] = row_delta_adjust[row] + col_delta_adjust[col];
+            }
+        }
+        
+        int num_non_zero_black_levels = 0;
+        int last_black_level = 0;
+        int _black_level;
+        for (int row = 0; row < mosaic_width; row++) {
+            for (int col = 0; col < mosaic_width; col++) {
+                double black_level = 0.0;
+                // If there are multiple samples, average them out
+                for (int sample_num = 0; sample_num < rawIFD.fSamplesPerPixel; sample_num++) {
+                    black_level += linearization_info->fBlackLevel[row][col][sample_num];
+                }
+                black_level /= rawIFD.fSamplesPerPixel;
+                
+                _black_level = (int) (black_level + black_level_delta_adjust[row + col*mosaic_width]);
+                *(black_levels + row + col*mosaic_width) = _black_level;
+                
+                if (_black_level != 0) {
+                    num_non_zero_black_levels++;
+                    last_black_level = _black_level;
+                }
+            }
+        }
+        
+        // Some cameras report a single black value which is supposed to be used for all channels.
+        // Catch and handle this case here.
+        if (num_non_zero_black_levels == 1) {
+            for (int row = 0; row < mosaic_width; row++) {
+                for (int col = 0; col < mosaic_width; col++) {
+                    *(black_levels + row + col*mosaic_width) = last_black_level;
+                }
+            }
+        }
+        
+        // 0 is treated as a suspicious black level, the black level measured in the masked areas is used instead
+        if (masked_area_black_levels != NULL) {
+            for (int i = 0; i < mosaic_width*mosaic_width; i++) {
+                if (black_levels[i] <= 0) {
+                    black_levels[i] = int(masked_area_black_levels[i] + 0.5);
+                }
+            }
+        }
+    }
+    
+    // get color factors for neutral colors in camera color space
+    const dng_vector camera_neutral = negative.CameraNeutral();
+    if (camera_neutral.IsEmpty()) {
+        printf("ERROR: CameraNeutral is null.\n");
+        return 1;
+    } else {
+        *color_factor_r = float(camera_neutral[0]);
+        *color_factor_g = float(camera_neutral[1]);
+        *color_factor_b = float(camera_neutral[2]);
+    }
+    
+    // Get exposure bias for exposure correction  and product of ISO value and exposure time for control of hot pixel correction
+    const dng_exif* exif = negative.GetExif();
+    if (exif == NULL) {
+        printf("ERROR: Exif is null.\n");
+        return 1;
+    } else {
+        const dng_srational exposure_bias_value = exif->fExposureBiasValue;
+        // scale exposure bias value that it is EV * 100
+        *exposure_bias = exposure_bias_value.n * 100/exposure_bias_value.d;
+        
+        const dng_urational exposure_time_value = exif->fExposureTime;
+        const uint32 ISO_speed_value = exif->fISOSpeedRatings[0];
+        // calculate product of ISO value and exposure time
+        *ISO_exposure_time = ISO_speed_value*exposure_time_value.n/float(exposure_time_value.d);
+    }
+    return 0;
+}
+
+
+// check whether a file is stored on a local volume
+// - files on network volumes are assumed to be slow to access
+static bool is_on_local_volume(const char* path) {
+#ifdef MNT_LOCAL
+    struct statfs volume_info;
+    if (statfs(path, &volume_info) == 0) {
+        return (volume_info.f_flags & MNT_LOCAL) != 0;
+    }
+#endif
+    return true;
+}
+
+
+// open a dng file for reading
+// - local files are memory-mapped if possible, so that the raw tiles are decoded straight from the mapping
+//   instead of being copied through the buffer of a file stream first
+// - files on network volumes are read with a file stream that fetches the raw tiles on a background thread
+//   ahead of decoding, so that the decoder does not wait for each tile
+static dng_stream* open_input_stream(const char* path) {
+    if (!is_on_local_volume(path)) {
+        return new dng_read_ahead_stream(path);
+    }
+    try {
+        return new dng_mmap_stream(path);
+    } catch(...) {
+        return new dng_file_stream(path);
+    }
 }
 
 
@@ -25,9 +249,11 @@ int read_dng_from_disk(const char* in_path, void** pixel_bytes_pointer, int* wid
     try {
         
         // read image
-        dng_host host;
+        // - the threaded host decodes and encodes the tiles of the raw image in parallel
+        dng_threaded_host host;
         dng_info info;
-        dng_file_stream stream(in_path);
+        AutoPtr<dng_stream> stream_pointer(open_input_stream(in_path));
+        dng_stream& stream = *stream_pointer.Get();
         AutoPtr<dng_negative> negative; {
             info.Parse(host, stream);
             info.PostParse(host);
@@ -58,197 +284,544 @@ int read_dng_from_disk(const char* in_path, void** pixel_bytes_pointer, int* wid
         *pixel_bytes_pointer = pixel_bytes;
         memcpy(pixel_bytes, pixel_buffer.DirtyPixel(0, 0), image_size);
         
-        // get size of mosaic pattern
-        // - this affects how raw pixels are aligned
-        // - it is assumed that the pattern is square
-        const dng_mosaic_info* mosaic_info = negative->GetMosaicInfo();
-        if (mosaic_info == NULL) {
-            *mosaic_pattern_width = 1;
-            printf("ERROR: MosaicInfo is null.\n");
-            return 1;
-        } else {
-            dng_point mosaic_pattern_size = negative->fMosaicInfo->fCFAPatternSize;
-            *mosaic_pattern_width = mosaic_pattern_size.h;
-        }
-               
-        // Get masked area
-        if (rawIFD.fMaskedAreaCount > 0) {
-            for (int i = 0; i < rawIFD.fMaskedAreaCount; i++) {
-                // Add masked areas to the array
-                *(masked_areas + i + 0) = rawIFD.fMaskedArea[i].t;
-                *(masked_areas + i + 1) = rawIFD.fMaskedArea[i].l;
-                *(masked_areas + i + 2) = rawIFD.fMaskedArea[i].b;
-                *(masked_areas + i + 3) = rawIFD.fMaskedArea[i].r;
-            }
+        return read_raw_metadata(*negative.Get(), rawIFD, NULL, mosaic_pattern_width, white_level, black_levels, masked_areas, exposure_bias, ISO_exposure_time, color_factor_r, color_factor_g, color_factor_b);
+    } catch(...) {
+        return 1;
+    }
+}
+
+
+// parsed dng file
+// - the metadata is parsed once and kept, so that the pixel values can be read and a new image can be written without parsing the file again
+// - the file stays open until the pixel values have been read
+struct dng_negative_handle {
+    // all memory of the DNG SDK for the image is allocated through this allocator, it is declared first so that it is released last
+    dng_counting_allocator allocator;
+    std::string path;
+    dng_info info;
+    AutoPtr<dng_negative> negative;
+    AutoPtr<dng_stream> stream;
+    // black levels measured in the masked areas when the pixel values are read (empty if the image has no masked areas)
+    std::vector<double> masked_area_black_levels;
+    // performance counters, see dng_io_stats
+    dng_perf_counters read_counters;
+    dng_perf_counters write_counters;
+    double parse_time = 0.0;
+    double encode_time = 0.0;
+};
+
+
+dng_negative_handle* open_dng_negative(const char* in_path) {
+    
+    try {
+        
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        AutoPtr<dng_negative_handle> handle(new dng_negative_handle);
+        handle->path = in_path;
+        handle->stream.Reset(open_input_stream(in_path));
+        
+        // parse metadata
+        // - the raw image is not decoded, so no worker threads are needed
+        dng_host host(&handle->allocator);
+        dng_info& info = handle->info;
+        dng_stream& stream = *handle->stream.Get();
+        info.Parse(host, stream);
+        info.PostParse(host);
+        if(!info.IsValidDNG()) {return NULL;}
+        handle->negative.Reset(host.Make_dng_negative());
+        // this line ensures that the maker notes are copied when a new image is written
+        host.SetSaveDNGVersion(dngVersion_SaveDefault);
+        handle->negative->Parse(host, stream, info);
+        handle->negative->PostParse(host, stream, info);
+        
+        // read opcode lists (required for lens calibration data)
+        handle->negative->ReadOpcodeLists(host, stream, info);
+        
+        handle->parse_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return handle.Release();
+    } catch(...) {
+        return NULL;
+    }
+}
+
+
+void close_dng_negative(dng_negative_handle* handle) {
+    delete handle;
+}
+
+
+int read_dng_negative_metadata(const dng_negative_handle* handle, int* width, int* height, int* mosaic_pattern_width, int* white_level, int* black_levels, int* masked_areas, int* exposure_bias, float* ISO_exposure_time, float* color_factor_r, float* color_factor_g, float* color_factor_b) {
+    
+    try {
+        
+        const dng_ifd& rawIFD = *handle->info.fIFD [handle->info.fMainIndex];
+        *width = rawIFD.Bounds().W();
+        *height = rawIFD.Bounds().H();
+        
+        const double* masked_area_black_levels = handle->masked_area_black_levels.empty() ? NULL : handle->masked_area_black_levels.data();
+        return read_raw_metadata(*handle->negative.Get(), rawIFD, masked_area_black_levels, mosaic_pattern_width, white_level, black_levels, masked_areas, exposure_bias, ISO_exposure_time, color_factor_r, color_factor_g, color_factor_b);
+    } catch(...) {
+        return 1;
+    }
+}
+
+
+void read_dng_negative_stats(const dng_negative_handle* handle, dng_io_stats* stats) {
+    
+    const dng_perf_counters& read_counters = handle->read_counters;
+    const dng_perf_counters& write_counters = handle->write_counters;
+    
+    // the time of the tiles includes the time of copying their pixel values
+    const uint64 tile_nanoseconds = read_counters.fTileNanoseconds + write_counters.fTileNanoseconds;
+    const uint64 copy_nanoseconds = read_counters.fCopyNanoseconds + write_counters.fCopyNanoseconds;
+    
+    stats->parse_time = handle->parse_time;
+    stats->bytes_read = (long long) read_counters.fTileBytes;
+    stats->tiles_decoded = (long long) read_counters.fTiles;
+    stats->tiles_encoded = (long long) write_counters.fTiles;
+    stats->codec_time = (tile_nanoseconds > copy_nanoseconds ? tile_nanoseconds - copy_nanoseconds : 0) * 1.0e-9;
+    stats->copy_time = copy_nanoseconds * 1.0e-9;
+    stats->allocator_high_water_mark = (long long) handle->allocator.high_water_mark();
+    stats->encode_time = handle->encode_time;
+}
+
+
+// decode the pixel values of a parsed dng image with at most the given number of threads of the shared pool (0 uses all of them)
+// - linear_pixel_type is NULL to store the raw 16-bit values, otherwise the values are linearized to floating point values of that type
+static int read_negative_pixels(dng_negative_handle* handle, dng_pixel_buffer_provider provide_buffer, void* context, uint32 thread_count, const dng_linear_pixel_type* linear_pixel_type) {
+    
+    try {
+        
+        // only single-channel 16-bit raw images can be stored in the caller's buffer
+        dng_ifd& rawIFD = *handle->info.fIFD [handle->info.fMainIndex];
+        if (rawIFD.fSamplesPerPixel != 1 || rawIFD.PixelType() != ttShort) {return dng_error_bad_format;}
+        const dng_linearization_info* linearization_info = handle->negative->GetLinearizationInfo();
+        if (linear_pixel_type != NULL && linearization_info == NULL) {return dng_error_bad_format;}
+        
+        // ask the caller for the memory to decode the pixels into
+        dng_rect bounds = rawIFD.Bounds();
+        const int pixel_size = linear_pixel_type == NULL ? TagTypeSize(ttShort) : *linear_pixel_type == dng_linear_float16 ? sizeof(uint16) : sizeof(real32);
+        int bytes_per_row = bounds.W() * pixel_size;
+        void* pixel_bytes = provide_buffer(context, bounds.W(), bounds.H(), &bytes_per_row);
+        if (pixel_bytes == NULL) {return dng_error_user_canceled;}
+        if (bytes_per_row < bounds.W() * pixel_size || bytes_per_row % pixel_size != 0) {return dng_error_unknown;}
+        
+        // the file is only opened again if the pixel values are read more than once
+        if (handle->stream.Get() == NULL) {
+            handle->stream.Reset(open_input_stream(handle->path.c_str()));
         }
         
-        int mosaic_width = *mosaic_pattern_width;
-        // Get black level, white level and color factors for exposure correction
-        const dng_linearization_info* linearization_info = negative->GetLinearizationInfo();
-        if (linearization_info == NULL) {
-            printf("ERROR: LinearizationInfo is null.\n");
-            return 1;
-        } else {
-            *white_level = int(linearization_info->fWhiteLevel[0]);
-            
-            // The following performs basic handling of fBlackDeltaV and fBlackDeltaH
-            // It is not fully correct, and will fail if each row and column have significant differences between black levels.
-            // The current support is added to allow for certain older canon cameras (e.g. Canon 350D) to work correctly since they rely on it.
-            double black_level_delta_adjust[6*6] = { 0 };
-            
-            if (linearization_info->RowBlackCount() > 0) {
-                for (int row = 0; row < linearization_info->RowBlackCount(); row++) {
-                    for (int col = 0; col < mosaic_width; col++) {
-                        black_level_delta_adjust[(row % mosaic_width) + col * mosaic_width] += linearization_info->fBlackDeltaV->Buffer_real64()[row];
-                    }
-                }
-                for (int i = 0; i < mosaic_width*mosaic_width; i++) {
-                    black_level_delta_adjust[i] /= (linearization_info->RowBlackCount() / mosaic_width);
-                }
-            }
+        // wrap the caller's memory in an image and decode the raw tiles straight into it
+        // - dng_simple_image (and dng_masked_area_image) does not take ownership of memory passed in a pixel buffer
+        // - dng_linear_image converts each tile while it is put into the image
+        // - the threaded host decodes the tiles of the raw image in parallel
+        dng_threaded_host host(&handle->allocator, NULL, thread_count);
+        host.SetPerfCounters(&handle->read_counters);
+        if (linear_pixel_type == NULL) {
             
-            if (linearization_info->ColumnBlackCount() > 0) {
-                for (int col = 0; col < linearization_info->ColumnBlackCount(); col++) {
-                    for (int row = 0; row < mosaic_width; row++) {
-                        black_level_delta_adjust[(row % mosaic_width) + col * mosaic_width] += linearization_info->fBlackDeltaH->Buffer_real64()[col];
-                    }
-                }
-                
-                for (int i = 0; i < mosaic_width*mosaic_width; i++) {
-                    black_level_delta_adjust[i] /= (linearization_info->ColumnBlackCount() / mosaic_width);
-                }
-            }
+            // the masked areas are summed while the tiles are decoded, so that the black levels are known without reading the image again
+            const dng_mosaic_info* mosaic_info = handle->negative->GetMosaicInfo();
+            const uint32 mosaic_pattern_width = mosaic_info != NULL ? mosaic_info->fCFAPatternSize.h : 1;
+            dng_pixel_buffer pixel_buffer(bounds, 0, 1, ttShort, pcInterleaved, pixel_bytes);
+            pixel_buffer.fRowStep = bytes_per_row / TagTypeSize(ttShort);
+            dng_masked_area_image image(pixel_buffer, rawIFD, mosaic_pattern_width, host.Allocator(), &handle->read_counters);
+            rawIFD.ReadImage(host, *handle->stream.Get(), image);
             
-            int num_non_zero_black_levels = 0;
-            int last_black_level = 0;
-            int _black_level;
-            for (int row = 0; row < mosaic_width; row++) {
-                for (int col = 0; col < mosaic_width; col++) {
-                    double black_level = 0.0;
-                    // If there are multiple samples, average them out
-                    for (int sample_num = 0; sample_num < rawIFD.fSamplesPerPixel; sample_num++) {
-                        black_level += linearization_info->fBlackLevel[row][col][sample_num];
-                    }
-                    black_level /= rawIFD.fSamplesPerPixel;
-                    
-                    _black_level = (int) (black_level + black_level_delta_adjust[row + col*mosaic_width]);
-                    *(black_levels + row + col*mosaic_width) = _black_level;
-                    
-                    if (_black_level != 0) {
-                        num_non_zero_black_levels++;
-                        last_black_level = _black_level;
-                    }
-                }
+            std::vector<double>& black_levels = handle->masked_area_black_levels;
+            black_levels.resize(mosaic_pattern_width * mosaic_pattern_width);
+            if (!image.black_levels(black_levels.data())) {
+                black_levels.clear();
             }
-            
-            // Some cameras report a single black value which is supposed to be used for all channels.
-            // Catch and handle this case here.
-            if (num_non_zero_black_levels == 1) {
-                for (int row = 0; row < mosaic_width; row++) {
-                    for (int col = 0; col < mosaic_width; col++) {
-                        *(black_levels + row + col*mosaic_width) = last_black_level;
-                    }
-                }
-            }
-        }
-        
-        // get color factors for neutral colors in camera color space
-        const dng_vector camera_neutral = negative->CameraNeutral();
-        if (camera_neutral.IsEmpty()) {
-            printf("ERROR: CameraNeutral is null.\n");
-            return 1;
         } else {
-            *color_factor_r = float(camera_neutral[0]);
-            *color_factor_g = float(camera_neutral[1]);
-            *color_factor_b = float(camera_neutral[2]);
+            dng_linear_image image(bounds, *linearization_info, *linear_pixel_type == dng_linear_float16, pixel_bytes, bytes_per_row, &handle->read_counters);
+            rawIFD.ReadImage(host, *handle->stream.Get(), image);
         }
         
-        // Get exposure bias for exposure correction  and product of ISO value and exposure time for control of hot pixel correction
-        const dng_exif* exif = negative->GetExif();
-        if (exif == NULL) {
-            printf("ERROR: Exif is null.\n");
-            return 1;
-        } else {
-            const dng_srational exposure_bias_value = exif->fExposureBiasValue;
-            // scale exposure bias value that it is EV * 100
-            *exposure_bias = exposure_bias_value.n * 100/exposure_bias_value.d;
-            
-            const dng_urational exposure_time_value = exif->fExposureTime;
-            const uint32 ISO_speed_value = exif->fISOSpeedRatings[0];
-            // calculate product of ISO value and exposure time
-            *ISO_exposure_time = ISO_speed_value*exposure_time_value.n/float(exposure_time_value.d);
-        }
+        // all data has been read from the file
+        handle->stream.Reset();
+        
         return 0;
     } catch(...) {
         return 1;
     }
 }
 
-int write_dng_to_disk(const char *in_path, const char *out_path, void** pixel_bytes_pointer, const int white_level) {
+
+int read_dng_negative_pixels(dng_negative_handle* handle, dng_pixel_buffer_provider provide_buffer, void* context) {
+    return read_negative_pixels(handle, provide_buffer, context, 0, NULL);
+}
+
+
+int read_dng_negative_linear_pixels(dng_negative_handle* handle, dng_linear_pixel_type pixel_type, dng_pixel_buffer_provider provide_buffer, void* context) {
+    return read_negative_pixels(handle, provide_buffer, context, 0, &pixel_type);
+}
+
+
+// restores the negative of a handle when writing it ends, also if writing fails
+// - the stage 1 image refers to the pixel provider of the caller, which is only valid during the write
+// - the handle is kept for later merges and metadata reads, so it must not keep the overwritten white level
+class negative_write_scope {
+
+public:
+    negative_write_scope(dng_negative& negative)
+        : negative(negative)
+        , original_white_level(negative.WhiteLevel(0)) {
+    }
+
+    ~negative_write_scope() {
+        negative.fStage1Image.Reset();
+        negative.SetWhiteLevel(original_white_level, 0);
+    }
+
+private:
+    dng_negative& negative;
+    const uint32 original_white_level;
+};
+
+
+int write_dng_negative_to_disk_from_provider(dng_negative_handle* handle, const char *out_path, dng_pixel_area_provider provide_pixels, void* context, const int white_level, dng_output_compression compression, int compression_level, long long* bytes_written, double* encode_time) {
     
     try {
         
-        // read image
-        dng_host host;
-        dng_info info;
-        dng_file_stream stream(in_path);
-        AutoPtr<dng_negative> negative; {
-            info.Parse(host, stream);
-            info.PostParse(host);
-            if(!info.IsValidDNG()) {return dng_error_bad_format;}
-            negative.Reset(host.Make_dng_negative());
-            // this line ensures that the maker notes are copied 
-            host.SetSaveDNGVersion(dngVersion_SaveDefault);
-            negative->Parse(host, stream, info);
-            negative->PostParse(host, stream, info);
-        }
-   
-        // load pixel buffer
-        dng_ifd& rawIFD = *info.fIFD [info.fMainIndex];
-        AutoPtr<dng_simple_image> image_pointer (new dng_simple_image(rawIFD.Bounds(), rawIFD.fSamplesPerPixel, rawIFD.PixelType(), host.Allocator()));
-        dng_simple_image& image = *image_pointer.Get();
-        // rawIFD.ReadImage(host, stream, image);
-         
-        
-        // read opcode lists (required for lens calibration data)
-        negative->ReadOpcodeLists(host, stream, info);
+        dng_threaded_host host(&handle->allocator);
+        host.SetSaveDNGVersion(dngVersion_SaveDefault);
+        host.SetPerfCounters(&handle->write_counters);
+        dng_negative& negative = *handle->negative.Get();
+        negative_write_scope scope(negative);
         
-        // overwrite pixel buffer
-        void* pixel_bytes = *pixel_bytes_pointer;
-        int image_size = image.Width() * image.Height() * image.PixelSize();
-        memcpy(image.fBuffer.DirtyPixel(0, 0), pixel_bytes, image_size);
-                
-        // store modified pixel buffer to the negative
-        negative->fStage1Image.Reset(image_pointer.Release());
+        // the new pixel values are requested tile by tile while the image is hashed and encoded
+        // - no copy of the whole image is made
+        dng_ifd& rawIFD = *handle->info.fIFD [handle->info.fMainIndex];
+        negative.fStage1Image.Reset(new dng_provider_image(rawIFD.Bounds(), rawIFD.fSamplesPerPixel, rawIFD.PixelType(), provide_pixels, context));
             
-        // validate the modified image
-        // - this resets some of the image stats like md5 checksums
-        // - running this function will print a warning "NewRawImageDigest does not match raw image"
-        //   but won't halt the program
-        // - without running this function, the output dng file would be considered 'damaged'
-        negative->ValidateRawImageDigest(host);
+        // discard the digests of the original pixel values
+        // - without this, the output dng file would be considered 'damaged'
+        // - the writer computes the NewRawImageDigest of the new pixel values from tiles that are hashed in parallel,
+        //   validating the old digest first (ValidateRawImageDigest) would hash the whole image an additional time
+        negative.ClearRawImageDigest();
                       
         // read metadata
         // - this doesn't seem to affect my test dng files but maybe it makes
         //   a difference for other files
         // - this is used in the dng_validate script
-        negative->SynchronizeMetadata();
+        negative.SynchronizeMetadata();
             
+        // the white level of the handle is restored after writing (negative_write_scope), so that the handle can be written again
         if (white_level > 0) {
-            negative->SetWhiteLevel(white_level, 0);
+            negative.SetWhiteLevel(white_level, 0);
+        }
+        
+        // render a thumbnail and a preview, so that the image can be viewed without rendering the raw data
+        // - the image is saved without them if they cannot be rendered
+        AutoPtr<dng_preview_list> previews(new dng_preview_list);
+        try {
+            append_quick_previews(host, negative, *previews.Get());
+        } catch (...) {
+            previews.Reset(new dng_preview_list);
         }
         
         // write dng
+        // - the threaded host encodes the tiles of compressed images in parallel (dng_write_tiles_task)
         host.SetSaveLinearDNG(false);
         host.SetKeepOriginalFile(false);
-        dng_file_stream stream2(out_path, true); {
+        dng_file_stream stream(out_path, true); {
             dng_image_writer writer;
-            writer.WriteDNG(host, stream2, *negative.Get());
+            switch (compression) {
+                case dng_output_uncompressed:
+                    writer.SetRawCompression(ccUncompressed);
+                    break;
+                case dng_output_deflate:
+                    writer.SetRawCompression(ccDeflate, compression_level);
+                    break;
+                default:
+                    writer.SetRawCompression(ccJPEG);
+                    break;
+            }
+            
+            const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            writer.WriteDNG(host, stream, negative, previews.Get());
+            stream.Flush();
+            
+            handle->encode_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            if (encode_time != NULL) {
+                *encode_time = handle->encode_time;
+            }
+            if (bytes_written != NULL) {
+                *bytes_written = (long long) stream.Length();
+            }
         }
-
     }
     catch(...) {
         return 1;
     }
     return 0;
 }
+
+
+// pixel values of a whole image in memory of the caller
+struct pixel_bytes_source {
+    const uint8* bytes;
+    uint32 bytes_per_row;
+    uint32 bytes_per_pixel;
+};
+
+
+// dng_pixel_area_provider that copies the rows of an area from a pixel_bytes_source
+static void copy_pixel_area(void* context, int left, int top, int width, int height, void* buffer, int bytes_per_row) {
+    
+    const pixel_bytes_source& source = *(const pixel_bytes_source*) context;
+    
+    for (int row = 0; row < height; row++) {
+        memcpy((uint8*) buffer + size_t(row) * bytes_per_row,
+               source.bytes + size_t(top + row) * source.bytes_per_row + size_t(left) * source.bytes_per_pixel,
+               size_t(width) * source.bytes_per_pixel);
+    }
+}
+
+
+int write_dng_negative_to_disk(dng_negative_handle* handle, const char *out_path, void** pixel_bytes_pointer, const int white_level, dng_output_compression compression, int compression_level, long long* bytes_written, double* encode_time) {
+    
+    // the pixel values are tightly packed rows of the size of the raw image
+    const dng_ifd& rawIFD = *handle->info.fIFD [handle->info.fMainIndex];
+    pixel_bytes_source source;
+    source.bytes = (const uint8*) *pixel_bytes_pointer;
+    source.bytes_per_pixel = rawIFD.fSamplesPerPixel * TagTypeSize(rawIFD.PixelType());
+    source.bytes_per_row = rawIFD.fImageWidth * source.bytes_per_pixel;
+    
+    return write_dng_negative_to_disk_from_provider(handle, out_path, copy_pixel_area, &source, white_level, compression, compression_level, bytes_written, encode_time);
+}
+
+
+int read_dng_from_disk_into_buffer(const char* in_path, dng_pixel_buffer_provider provide_buffer, void* context, int* width, int* height, int* mosaic_pattern_width, int* white_level, int* black_levels, int* masked_areas, int* exposure_bias, float* ISO_exposure_time, float* color_factor_r, float* color_factor_g, float* color_factor_b) {
+
+    dng_negative_handle* handle = open_dng_negative(in_path);
+    if (handle == NULL) {return 1;}
+    
+    int error_code = read_dng_negative_pixels(handle, provide_buffer, context);
+    if (error_code == 0) {
+        error_code = read_dng_negative_metadata(handle, width, height, mosaic_pattern_width, white_level, black_levels, masked_areas, exposure_bias, ISO_exposure_time, color_factor_r, color_factor_g, color_factor_b);
+    }
+    
+    close_dng_negative(handle);
+    return error_code;
+}
+
+
+int read_dng_metadata(const char* in_path, int* width, int* height, int* mosaic_pattern_width, int* white_level, int* black_levels, int* masked_areas, int* exposure_bias, float* ISO_exposure_time, float* color_factor_r, float* color_factor_g, float* color_factor_b) {
+
+    try {
+        
+        // parse the header only
+        // - the opcode lists and the raw image are not read
+        // - the parser only makes a few small reads near the start of the file, which a plain file stream serves from its buffer,
+        //   mapping the file or reading it ahead would only add cost
+        dng_host host;
+        dng_file_stream stream(in_path);
+        dng_info info;
+        info.Parse(host, stream);
+        info.PostParse(host);
+        if(!info.IsValidDNG()) {return dng_error_bad_format;}
+        AutoPtr<dng_negative> negative(host.Make_dng_negative());
+        negative->Parse(host, stream, info);
+        negative->PostParse(host, stream, info);
+        
+        const dng_ifd& rawIFD = *info.fIFD [info.fMainIndex];
+        *width = rawIFD.Bounds().W();
+        *height = rawIFD.Bounds().H();
+        
+        return read_raw_metadata(*negative.Get(), rawIFD, NULL, mosaic_pattern_width, white_level, black_levels, masked_areas, exposure_bias, ISO_exposure_time, color_factor_r, color_factor_g, color_factor_b);
+    } catch(...) {
+        return 1;
+    }
+}
+
+
+int write_dng_to_disk(const char *in_path, const char *out_path, void** pixel_bytes_pointer, const int white_level, dng_output_compression compression, int compression_level, long long* bytes_written, double* encode_time) {
+    
+    dng_negative_handle* handle = open_dng_negative(in_path);
+    if (handle == NULL) {return 1;}
+    
+    int error_code = write_dng_negative_to_disk(handle, out_path, pixel_bytes_pointer, white_level, compression, compression_level, bytes_written, encode_time);
+    
+    close_dng_negative(handle);
+    return error_code;
+}
+
+
+// state shared between the threads that decode a burst
+// - frames are decoded by a limited number of workers, the calling thread hands them over in the order of the paths
+// - the memory of a decoded frame counts towards the budget until the frame has been handed over
+// - the workers either open the images from paths, then the handles are owned by the loader until they are handed over,
+//   or decode images that the caller has already opened, then the handles stay owned by the caller
+struct dng_burst_loader {
+    
+    struct frame {
+        dng_negative_handle* handle = NULL;
+        void* pixel_bytes = NULL;
+        int width = 0;
+        int height = 0;
+        int bytes_per_row = 0;
+        int error_code = 0;
+        bool done = false;
+    };
+    
+    // context of the buffer provider of a single frame
+    struct frame_request {
+        dng_burst_loader* loader;
+        int index;
+    };
+    
+    const char** paths = NULL;
+    dng_negative_handle** handles = NULL;
+    int count;
+    long long memory_budget;
+    uint32 threads_per_frame;
+    
+    std::vector<frame> frames;
+    std::mutex mutex;
+    std::condition_variable frame_done;
+    std::condition_variable memory_released;
+    int next_frame = 0;
+    int next_delivery = 0;
+    long long memory_used = 0;
+    bool stopping = false;
+    
+    static void* provide_buffer(void* context, int width, int height, int* bytes_per_row);
+    void worker_loop();
+};
+
+
+void* dng_burst_loader::provide_buffer(void* context, int width, int height, int* bytes_per_row) {
+    
+    frame_request& request = *static_cast<frame_request*>(context);
+    dng_burst_loader& loader = *request.loader;
+    const long long size = (long long)height * (*bytes_per_row);
+    
+    // wait until the frame fits into the memory budget
+    // - the frame that is handed over next never waits, otherwise frames decoded ahead of it could use up the budget forever
+    std::unique_lock<std::mutex> lock(loader.mutex);
+    loader.memory_released.wait(lock, [&] {
+        return loader.stopping || loader.memory_budget <= 0 || request.index == loader.next_delivery || loader.memory_used + size <= loader.memory_budget;
+    });
+    if (loader.stopping) {return NULL;}
+    
+    void* pixel_bytes = malloc(size);
+    if (pixel_bytes == NULL) {return NULL;}
+    loader.memory_used += size;
+    
+    frame& frame = loader.frames[request.index];
+    frame.pixel_bytes = pixel_bytes;
+    frame.width = width;
+    frame.height = height;
+    frame.bytes_per_row = *bytes_per_row;
+    return pixel_bytes;
+}
+
+
+void dng_burst_loader::worker_loop() {
+    
+    while (true) {
+        
+        int index; {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (stopping || next_frame >= count) {return;}
+            index = next_frame++;
+        }
+        
+        // parse and decode the frame
+        int error_code = dng_error_unknown;
+        dng_negative_handle* handle = handles != NULL ? handles[index] : open_dng_negative(paths[index]);
+        if (handle != NULL) {
+            frame_request request = {this, index};
+            error_code = read_negative_pixels(handle, provide_buffer, &request, threads_per_frame, NULL);
+        }
+        
+        std::lock_guard<std::mutex> lock(mutex);
+        frame& frame = frames[index];
+        frame.handle = handle;
+        frame.error_code = error_code;
+        frame.done = true;
+        frame_done.notify_all();
+    }
+}
+
+
+// decode the frames of a burst and hand them over in order, see read_dng_burst_from_disk
+static int read_burst(dng_burst_loader& loader, int count, int worker_count, long long memory_budget, dng_burst_frame_handler handle_frame, void* context) {
+    
+    const bool owns_handles = loader.handles == NULL;
+    loader.count = count;
+    loader.memory_budget = memory_budget;
+    loader.frames.resize(count);
+    
+    // split the cores between the frames that are decoded at the same time
+    const int core_count = Max_int32(int(std::thread::hardware_concurrency()), 1);
+    worker_count = Pin_int32(1, worker_count > 0 ? worker_count : core_count, Max_int32(count, 1));
+    loader.threads_per_frame = Max_uint32(uint32(core_count / worker_count), 1);
+    
+    std::vector<std::thread> workers;
+    for (int i = 0; i < worker_count; i++) {
+        workers.push_back(std::thread(&dng_burst_loader::worker_loop, &loader));
+    }
+    
+    // hand over the frames in order as soon as they are decoded
+    int error_code = 0;
+    for (int i = 0; i < count && error_code == 0; i++) {
+        
+        dng_burst_loader::frame frame; {
+            std::unique_lock<std::mutex> lock(loader.mutex);
+            loader.frame_done.wait(lock, [&] {return loader.frames[i].done;});
+            frame = loader.frames[i];
+            loader.frames[i].handle = NULL;
+            loader.frames[i].pixel_bytes = NULL;
+        }
+        
+        error_code = frame.error_code;
+        if (error_code == 0) {
+            // the callee takes ownership of the handle if the loader owns it
+            if (handle_frame(context, i, frame.handle, frame.pixel_bytes, frame.width, frame.height, frame.bytes_per_row) != 0) {
+                error_code = dng_error_user_canceled;
+            }
+        } else if (owns_handles) {
+            close_dng_negative(frame.handle);
+        }
+        free(frame.pixel_bytes);
+        
+        // release the memory of the frame and allow the next frame to be decoded
+        std::lock_guard<std::mutex> lock(loader.mutex);
+        loader.memory_used -= (long long)frame.height * frame.bytes_per_row;
+        loader.next_delivery = i + 1;
+        loader.stopping = error_code != 0;
+        loader.memory_released.notify_all();
+    }
+    
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    
+    // release frames that were decoded but not handed over
+    for (int i = 0; i < count; i++) {
+        if (owns_handles) {
+            close_dng_negative(loader.frames[i].handle);
+        }
+        free(loader.frames[i].pixel_bytes);
+    }
+    
+    return error_code;
+}
+
+
+int read_dng_burst_from_disk(const char** in_paths, int count, int worker_count, long long memory_budget, dng_burst_frame_handler handle_frame, void* context) {
+    
+    dng_burst_loader loader;
+    loader.paths = in_paths;
+    return read_burst(loader, count, worker_count, memory_budget, handle_frame, context);
+}
+
+
+int read_dng_burst_negatives(dng_negative_handle** handles, int count, int worker_count, long long memory_budget, dng_burst_frame_handler handle_frame, void* context) {
+    
+    dng_burst_loader loader;
+    loader.handles = handles;
+    return read_burst(loader, count, worker_count, memory_budget, handle_frame, context);
+}
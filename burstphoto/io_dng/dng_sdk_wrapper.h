@@ -7,7 +7,8 @@
 extern "C" {
 #endif
 
-    // initialize / terminate Adobe XMP SDK
+    // initialize / terminate Adobe XMP SDK and the pool of threads that is shared by all reads and writes of dng images
+    // - the threads are started once, files that are read or written at the same time share them instead of starting their own
     void initialize_xmp_sdk();
     void terminate_xmp_sdk();
 
@@ -15,8 +16,124 @@ extern "C" {
     // function to read a dng image and store its pixel values
     int read_dng_from_disk(const char* in_path, void** pixel_bytes_pointer, int* width, int* height, int* mosaic_pattern_width, int* white_level, int* black_level, int* masked_areas, int* exposure_bias, float* ISO_exposure_time, float* color_factor_r, float* color_factor_g, float* color_factor_b);
 
+    // callback that provides the memory a raw image is decoded into
+    // - it is called with the size of the image and returns a pointer to at least height * bytes_per_row bytes, or NULL to cancel reading
+    // - bytes_per_row is initialized with the size of a tightly packed row of pixels (16-bit unless stated otherwise) and can be increased for padded rows
+    typedef void* (*dng_pixel_buffer_provider)(void* context, int width, int height, int* bytes_per_row);
+
+    // function to read a dng image and decode its pixel values directly into memory provided by the caller
+    int read_dng_from_disk_into_buffer(const char* in_path, dng_pixel_buffer_provider provide_buffer, void* context, int* width, int* height, int* mosaic_pattern_width, int* white_level, int* black_level, int* masked_areas, int* exposure_bias, float* ISO_exposure_time, float* color_factor_r, float* color_factor_g, float* color_factor_b);
+
+    // function to read the metadata of a dng image without decoding its pixel values
+    // - only the header is parsed, the opcode lists and the raw image are not read
+    // - the black levels are the ones stored in the file, black levels estimated from masked areas require the pixel values
+    int read_dng_metadata(const char* in_path, int* width, int* height, int* mosaic_pattern_width, int* white_level, int* black_level, int* masked_areas, int* exposure_bias, float* ISO_exposure_time, float* color_factor_r, float* color_factor_g, float* color_factor_b);
+
+    // parsed dng image that can be used for several operations without parsing the file again
+    // - a handle is opened once, its metadata and pixel values can be read and a new image can be written from it
+    typedef struct dng_negative_handle dng_negative_handle;
+
+    // function to parse a dng image, returns NULL if the file cannot be read
+    dng_negative_handle* open_dng_negative(const char* in_path);
+
+    // function to release a parsed dng image
+    void close_dng_negative(dng_negative_handle* handle);
+
+    // function to read the metadata of a parsed dng image
+    // - after the pixel values have been read, black levels of 0 are replaced by the black levels measured in the masked areas of the image,
+    //   which are summed while the pixel values are decoded
+    // - masked_areas receives the top, left, bottom and right edge of each masked area
+    int read_dng_negative_metadata(const dng_negative_handle* handle, int* width, int* height, int* mosaic_pattern_width, int* white_level, int* black_level, int* masked_areas, int* exposure_bias, float* ISO_exposure_time, float* color_factor_r, float* color_factor_g, float* color_factor_b);
+
+    // function to decode the pixel values of a parsed dng image directly into memory provided by the caller
+    int read_dng_negative_pixels(dng_negative_handle* handle, dng_pixel_buffer_provider provide_buffer, void* context);
+
+    // floating point formats of linearized pixel values
+    typedef enum dng_linear_pixel_type {
+        dng_linear_float32 = 0,
+        dng_linear_float16 = 1
+    } dng_linear_pixel_type;
+
+    // function to decode the pixel values of a parsed dng image into linear floating point values in memory provided by the caller
+    // - the linearization table, the black levels of each position of the black level pattern (including BlackLevelDeltaH/V) and the white level
+    //   are applied to each tile as soon as it is decoded, there is no second pass over the image
+    // - black is 0.0 and white is 1.0, values below black are not clipped
+    // - bytes_per_row passed to provide_buffer is initialized with the size of a tightly packed row of 32-bit or 16-bit floats
+    int read_dng_negative_linear_pixels(dng_negative_handle* handle, dng_linear_pixel_type pixel_type, dng_pixel_buffer_provider provide_buffer, void* context);
+
+    // compression of the raw image of a saved dng image
+    typedef enum dng_output_compression {
+        dng_output_uncompressed = 0,
+        dng_output_lossless_jpeg = 1,
+        dng_output_deflate = 2
+    } dng_output_compression;
+
+    // function to save a parsed dng image with new pixel values
+    // - compression_level is the zlib level (1 fastest to 9 smallest) for deflate, -1 uses the default level
+    // - the tiles of compressed images are encoded on all cores
+    // - bytes_written and encode_time (in seconds) are set if they are not NULL
+    int write_dng_negative_to_disk(dng_negative_handle* handle, const char *out_path, void** pixel_bytes_pointer, const int white_level, dng_output_compression compression, int compression_level, long long* bytes_written, double* encode_time);
+
+    // callback that provides the pixel values of an area of an image that is saved
+    // - it copies the rows of the area (left, top, width, height) into buffer, consecutive rows are bytes_per_row apart
+    // - it is called for every tile while the image is encoded, possibly from several threads at the same time
+    typedef void (*dng_pixel_area_provider)(void* context, int left, int top, int width, int height, void* buffer, int bytes_per_row);
+
+    // function to save a parsed dng image with new pixel values that are requested from provide_pixels
+    // - encoding starts without a copy of the whole image, tiles are copied straight from the caller's pixel values into the encoder
+    int write_dng_negative_to_disk_from_provider(dng_negative_handle* handle, const char *out_path, dng_pixel_area_provider provide_pixels, void* context, const int white_level, dng_output_compression compression, int compression_level, long long* bytes_written, double* encode_time);
+
+    // performance counters of the operations done with a parsed dng image
+    // - times are in seconds, codec_time and copy_time are summed over all threads that decode or encode tiles
+    typedef struct dng_io_stats {
+        double parse_time;                      // parsing the metadata when the image was opened
+        long long bytes_read;                   // compressed bytes of the raw tiles that have been decoded
+        long long tiles_decoded;                // number of raw tiles that have been decoded
+        long long tiles_encoded;                // number of tiles that have been encoded when the image was saved
+        double codec_time;                      // decoding and encoding tiles, without copying pixel values
+        double copy_time;                       // copying pixel values between tile buffers and the caller's memory
+        long long allocator_high_water_mark;    // largest number of bytes allocated by the DNG SDK for the image at the same time
+        double encode_time;                     // wall time of the last save of the image
+    } dng_io_stats;
+
+    // function to read the performance counters of all operations done with a parsed dng image so far
+    void read_dng_negative_stats(const dng_negative_handle* handle, dng_io_stats* stats);
+
+    // callback that receives a decoded frame of a burst
+    // - the pixel values are only valid during the call
+    // - with read_dng_burst_from_disk the handle is owned by the callee and has to be released with close_dng_negative,
+    //   with read_dng_burst_negatives it stays owned by the caller of that function
+    // - returning a non-zero value stops reading the burst
+    typedef int (*dng_burst_frame_handler)(void* context, int index, dng_negative_handle* handle, const void* pixel_bytes, int width, int height, int bytes_per_row);
+
+    // function to read the dng images of a burst with a limited number of threads and memory
+    // - the frames are passed to handle_frame in the order of the paths, on the calling thread, while the following frames are decoded
+    // - worker_count is the number of images decoded at the same time (0 uses one per core)
+    // - memory_budget limits the bytes of decoded frames that have not been handed over yet (0 means no limit)
+    int read_dng_burst_from_disk(const char** in_paths, int count, int worker_count, long long memory_budget, dng_burst_frame_handler handle_frame, void* context);
+
+    // function to read the pixel values of dng images of a burst that have already been opened with open_dng_negative, e.g. to check their metadata first
+    // - works like read_dng_burst_from_disk, but the images are not parsed again and the handles stay owned by the caller
+    int read_dng_burst_negatives(dng_negative_handle** handles, int count, int worker_count, long long memory_budget, dng_burst_frame_handler handle_frame, void* context);
+
+    // decoded frame of a dng image in the on-disk frame cache
+    typedef struct dng_cached_frame dng_cached_frame;
+
+    // function to look up the decoded pixel values and metadata of a dng image in a cache directory
+    // - entries are identified by a fingerprint of the file identity (device, inode, modification time), its size and parts of its content, so the image does not have to be parsed
+    // - returns NULL if there is no valid entry, otherwise pixel_bytes points to the memory-mapped pixel values until the frame is closed
+    // - the black levels are the final ones, including black levels estimated from masked areas
+    dng_cached_frame* open_cached_frame(const char* cache_dir, const char* in_path, const void** pixel_bytes, int* width, int* height, int* bytes_per_row, int* mosaic_pattern_width, int* white_level, int* black_level, int* exposure_bias, float* ISO_exposure_time, float* color_factor_r, float* color_factor_g, float* color_factor_b);
+
+    // function to release a frame from the frame cache
+    void close_cached_frame(dng_cached_frame* frame);
+
+    // function to store the decoded pixel values and metadata of a dng image in a cache directory
+    // - black_level contains mosaic_pattern_width * mosaic_pattern_width values
+    int write_cached_frame(const char* cache_dir, const char* in_path, const void* pixel_bytes, int width, int height, int bytes_per_row, int mosaic_pattern_width, int white_level, const int* black_level, int exposure_bias, float ISO_exposure_time, float color_factor_r, float color_factor_g, float color_factor_b);
+
     // function to read a dng image, overwrite its pixel values, and save the result
-    int write_dng_to_disk(const char *in_path, const char *out_path, void** pixel_bytes_pointer, const int white_level);
+    int write_dng_to_disk(const char *in_path, const char *out_path, void** pixel_bytes_pointer, const int white_level, dng_output_compression compression, int compression_level, long long* bytes_written, double* encode_time);
 
 #ifdef __cplusplus
 }
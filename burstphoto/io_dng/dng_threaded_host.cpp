@@ -0,0 +1,237 @@
+#include "dng_threaded_host.h"
+#include "dng_area_task.h"
+#include "dng_rect.h"
+#include "dng_utils.h"
+
+#include <atomic>
+
+
+// set on threads that are currently executing a job of a pool
+// - nested calls to run() from inside a job are executed serially to avoid deadlocks
+static thread_local bool inside_pool_job = false;
+
+
+// the per-thread buffers of the area tasks are allocated for the number of threads they are started with,
+// so the pool is not limited to kMaxMPThreads and can use all cores of large machines
+static uint32 default_thread_count() {
+
+    uint32 thread_count = std::thread::hardware_concurrency();
+    return Max_uint32(thread_count, 1);
+}
+
+
+// process-wide pool, see dng_thread_pool::shared()
+static std::mutex shared_pool_mutex;
+static std::shared_ptr<dng_thread_pool> shared_pool;
+
+
+dng_thread_pool::dng_thread_pool(uint32 thread_count)
+    : stopping(false) {
+
+    for (uint32 i = 1; i < thread_count; i++) {
+        workers.push_back(std::thread(&dng_thread_pool::worker_loop, this));
+    }
+}
+
+
+dng_thread_pool::~dng_thread_pool() {
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    work_available.notify_all();
+
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+
+void dng_thread_pool::run(uint32 count, const std::function<void(uint32)>& job) {
+
+    // run serially if there is nothing to parallelize
+    if (count <= 1 || workers.empty() || inside_pool_job) {
+        for (uint32 i = 0; i < count; i++) {
+            job(i);
+        }
+        return;
+    }
+
+    batch jobs;
+    jobs.job = &job;
+    jobs.count = count;
+    jobs.next_index = 0;
+    jobs.pending = count;
+
+    std::unique_lock<std::mutex> lock(mutex);
+
+    // publish the batch, the workers serve it in turn with the batches of other threads
+    batches.push_back(&jobs);
+    work_available.notify_all();
+
+    // help with the own batch only and wait until the workers are done with it
+    while (jobs.next_index < jobs.count) {
+        execute_job(jobs, claim_job(jobs), lock);
+    }
+    jobs.done.wait(lock, [&jobs] { return jobs.pending == 0; });
+
+    std::exception_ptr error = jobs.first_error;
+    lock.unlock();
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+
+void dng_thread_pool::worker_loop() {
+
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (true) {
+        work_available.wait(lock, [this] { return stopping || !batches.empty(); });
+        if (stopping) {
+            return;
+        }
+
+        // take one job of the batch that has waited longest and move the batch to the end of the queue,
+        // so that concurrent batches get the workers alternately instead of the first batch getting all of them
+        batch& jobs = *batches.front();
+        batches.splice(batches.end(), batches, batches.begin());
+        execute_job(jobs, claim_job(jobs), lock);
+    }
+}
+
+
+// take the next job of a batch and remove the batch from the queue once all of its jobs are taken
+// - must be called with the lock held and only if the batch has jobs left
+uint32 dng_thread_pool::claim_job(batch& jobs) {
+
+    const uint32 index = jobs.next_index++;
+    if (jobs.next_index == jobs.count) {
+        batches.remove(&jobs);
+    }
+    return index;
+}
+
+
+// execute a job of a batch and notify the thread waiting for the batch when it was the last one
+// - must be called with the lock held, the lock is released while the job is running
+void dng_thread_pool::execute_job(batch& jobs, uint32 index, std::unique_lock<std::mutex>& lock) {
+
+    const std::function<void(uint32)>& job = *jobs.job;
+
+    lock.unlock();
+    std::exception_ptr error;
+    inside_pool_job = true;
+    try {
+        job(index);
+    } catch (...) {
+        error = std::current_exception();
+    }
+    inside_pool_job = false;
+    lock.lock();
+
+    if (error && !jobs.first_error) {
+        jobs.first_error = error;
+    }
+    if (--jobs.pending == 0) {
+        jobs.done.notify_all();
+    }
+}
+
+
+void dng_thread_pool::initialize_shared(uint32 thread_count) {
+
+    std::lock_guard<std::mutex> lock(shared_pool_mutex);
+    if (!shared_pool) {
+        shared_pool = std::make_shared<dng_thread_pool>(thread_count > 0 ? thread_count : default_thread_count());
+    }
+}
+
+
+void dng_thread_pool::terminate_shared() {
+
+    std::lock_guard<std::mutex> lock(shared_pool_mutex);
+    shared_pool.reset();
+}
+
+
+std::shared_ptr<dng_thread_pool> dng_thread_pool::shared() {
+
+    std::lock_guard<std::mutex> lock(shared_pool_mutex);
+    if (!shared_pool) {
+        shared_pool = std::make_shared<dng_thread_pool>(default_thread_count());
+    }
+    return shared_pool;
+}
+
+
+dng_threaded_host::dng_threaded_host(dng_memory_allocator* allocator, dng_abort_sniffer* sniffer, uint32 thread_count)
+    : dng_host(allocator, sniffer)
+    , pool(dng_thread_pool::shared())
+    , max_threads(thread_count > 0 ? thread_count : pool->thread_count()) {
+}
+
+
+void dng_threaded_host::PerformAreaTask(dng_area_task& task, const dng_rect& area, dng_area_task_progress* progress) {
+
+    const dng_point tile_size = task.FindTileSize(area);
+    const uint32 tiles_down = (area.H() + tile_size.v - 1) / tile_size.v;
+    const uint32 tiles_across = (area.W() + tile_size.h - 1) / tile_size.h;
+    const uint32 tile_count = tiles_down * tiles_across;
+
+    // do not use more threads than the task supports or than there are tiles or areas of the minimum task size
+    uint32 thread_count = Min_uint32(task.MaxThreads(), PerformAreaTaskThreads());
+    thread_count = Min_uint32(thread_count, tile_count);
+    const uint64 min_task_area = Max_uint32(task.MinTaskArea(), 1);
+    const uint64 area_size = uint64(area.W()) * uint64(area.H());
+    thread_count = uint32(Min_uint64(thread_count, Max_uint64(area_size / min_task_area, 1)));
+
+    if (thread_count <= 1) {
+        dng_area_task::Perform(task, area, &Allocator(), Sniffer(), progress);
+        return;
+    }
+
+    task.Start(thread_count, area, tile_size, &Allocator(), Sniffer());
+
+    // the threads claim one tile at a time in row-major order until all tiles are taken
+    // - tiles take different amounts of time (e.g. at the image border or for opcodes that only cover a part of the image),
+    //   so a thread that is done early keeps taking tiles instead of waiting for a fixed share of the others
+    // - each thread keeps its index for all of its tiles, so the per-thread buffers of the task allocated in Start() can be used
+    // - the tiles are aligned to the tile size found above, so repeating tiles of the task stay aligned as well
+    std::atomic<uint32> next_tile(0);
+
+    pool->run(thread_count, [&](uint32 thread_index) {
+        try {
+            for (uint32 index = next_tile++; index < tile_count; index = next_tile++) {
+
+                dng_rect tile;
+                tile.t = area.t + int32(index / tiles_across) * tile_size.v;
+                tile.l = area.l + int32(index % tiles_across) * tile_size.h;
+                tile.b = Min_int32(tile.t + tile_size.v, area.b);
+                tile.r = Min_int32(tile.l + tile_size.h, area.r);
+
+                task.ProcessOnThread(thread_index, tile, tile_size, Sniffer(), progress);
+            }
+        } catch (...) {
+            // stop the other threads from taking further tiles
+            next_tile = tile_count;
+            throw;
+        }
+    });
+
+    task.Finish(thread_count);
+}
+
+
+uint32 dng_threaded_host::PerformAreaTaskThreads() {
+
+    // area tasks started from inside a job of the pool are executed serially (see dng_thread_pool::run),
+    // so code that splits its work by this count (e.g. decoding a lossless JPEG tile in parts) must not expect more than one thread
+    if (inside_pool_job) {
+        return 1;
+    }
+    return Min_uint32(max_threads, pool->thread_count());
+}
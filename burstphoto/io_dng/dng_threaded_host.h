@@ -0,0 +1,91 @@
+#ifndef __dng_threaded_host__
+#define __dng_threaded_host__
+
+#include "dng_host.h"
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+// fixed-size pool of worker threads
+// - run() calls the job once for every index in [0, count) and blocks until all calls have returned
+// - the calling thread takes part in the work, so a pool of n threads only spawns n-1 workers
+// - several threads can call run() at the same time, the workers take the jobs of the concurrent batches in turn,
+//   so that each batch gets a fair share of the workers and the total number of busy threads stays at the size of the pool
+//   (plus the calling threads, which only work on their own batch)
+// - the first exception thrown by a job is re-thrown on the calling thread
+class dng_thread_pool {
+
+public:
+    explicit dng_thread_pool(uint32 thread_count);
+    ~dng_thread_pool();
+
+    uint32 thread_count() const {
+        return uint32(workers.size()) + 1;
+    }
+
+    void run(uint32 count, const std::function<void(uint32)>& job);
+
+    // process-wide pool that is shared by all threaded hosts, so that decoding many files at the same time does not start threads for each of them
+    // - initialize_shared() creates the pool with the given number of threads (0 uses all cores), it has no effect if the pool already exists
+    // - terminate_shared() releases the pool, the threads are stopped once the last host using them is destroyed
+    // - shared() returns the pool and creates it with all cores if it has not been initialized
+    static void initialize_shared(uint32 thread_count = 0);
+    static void terminate_shared();
+    static std::shared_ptr<dng_thread_pool> shared();
+
+private:
+    // jobs of one call of run()
+    struct batch {
+        const std::function<void(uint32)>* job;
+        uint32 count;
+        uint32 next_index;
+        uint32 pending;
+        std::exception_ptr first_error;
+        std::condition_variable done;
+    };
+
+    void worker_loop();
+    uint32 claim_job(batch& jobs);
+    void execute_job(batch& jobs, uint32 index, std::unique_lock<std::mutex>& lock);
+
+    std::vector<std::thread> workers;
+
+    // guards the batches and their state
+    std::mutex mutex;
+    std::condition_variable work_available;
+
+    // batches that have jobs that have not been started yet, in the order in which the workers serve them
+    std::list<batch*> batches;
+    bool stopping;
+};
+
+
+// dng_host that distributes area tasks over the threads of the shared pool
+// - the DNG SDK already splits reading and writing of tiled images into independent tiles
+//   (dng_read_tiles_task, dng_write_tiles_task), but the default dng_host runs everything on one thread
+// - the tiles of an area task are handed out to the threads one at a time, so the threads stay busy until the whole area is done
+// - a thread count of 0 uses all threads of the pool, otherwise at most thread_count threads work on each area task of the host
+// - PerformAreaTaskThreads() is 1 on threads that execute a job of the pool, because nested area tasks run serially
+class dng_threaded_host : public dng_host {
+
+public:
+    dng_threaded_host(dng_memory_allocator* allocator = NULL, dng_abort_sniffer* sniffer = NULL, uint32 thread_count = 0);
+
+    virtual void PerformAreaTask(dng_area_task& task, const dng_rect& area, dng_area_task_progress* progress = NULL);
+
+    virtual uint32 PerformAreaTaskThreads();
+
+private:
+    std::shared_ptr<dng_thread_pool> pool;
+    const uint32 max_threads;
+};
+
+
+#endif
@@ -12,8 +12,10 @@ class ImageCacheWrapper : NSObject {
     let exposure_bias: Int
     let ISO_exposure_time: Double
     let color_factors: [Double]
+    // nil for images loaded from the on-disk frame cache, which are not parsed
+    let negative: DNGNegative?
     
-    init(texture: MTLTexture, mosaic_pattern_width: Int, white_level: Int, black_levels: [Int], exposure_bias: Int, ISO_exposure_time: Double, color_factors: [Double]) {
+    init(texture: MTLTexture, mosaic_pattern_width: Int, white_level: Int, black_levels: [Int], exposure_bias: Int, ISO_exposure_time: Double, color_factors: [Double], negative: DNGNegative?) {
         self.texture = texture
         self.mosaic_pattern_width = mosaic_pattern_width
         self.white_level = white_level
@@ -21,6 +23,67 @@ class ImageCacheWrapper : NSObject {
         self.exposure_bias = exposure_bias
         self.ISO_exposure_time = ISO_exposure_time
         self.color_factors = color_factors
+        self.negative = negative
+    }
+}
+
+/**
+ Parsed DNG file. The metadata is parsed once when the image is loaded and reused when the merged image is saved, so that the reference image does not have to be parsed again.
+ */
+class DNGNegative {
+    let handle: OpaquePointer
+    
+    init(_ url: URL) throws {
+        guard let handle = open_dng_negative(url.path) else {throw ImageIOError.load_error}
+        self.handle = handle
+    }
+    
+    /// Take ownership of a handle that has already been opened, e.g. by `read_dng_burst_from_disk`.
+    init(_ handle: OpaquePointer) {
+        self.handle = handle
+    }
+    
+    /// Resolution of the raw image, read from the parsed metadata without decoding the pixel values.
+    func resolution() throws -> (Int, Int) {
+        var width: Int32 = 0
+        var height: Int32 = 0
+        var mosaic_pattern_width: Int32 = 0
+        var white_level: Int32 = -1
+        var black_level: [Int32] = [Int32](repeating: -1, count: 6*6)
+        var masked_areas: [Int32] = [Int32](repeating: -1, count: 4*4)
+        var exposure_bias: Int32 = -1
+        var ISO_exposure_time: Float32 = 0.0
+        var color_factor_r: Float32 = -1.0
+        var color_factor_g: Float32 = -1.0
+        var color_factor_b: Float32 = -1.0
+        
+        let error_code = read_dng_negative_metadata(handle, &width, &height, &mosaic_pattern_width, &white_level, &black_level, &masked_areas, &exposure_bias, &ISO_exposure_time, &color_factor_r, &color_factor_g, &color_factor_b)
+        if (error_code != 0) {throw ImageIOError.load_error}
+        
+        return (Int(width), Int(height))
+    }
+    
+    /// Performance counters of all operations done with the image so far (parsing, decoding and saving).
+    var stats: dng_io_stats {
+        var stats = dng_io_stats()
+        read_dng_negative_stats(handle, &stats)
+        return stats
+    }
+    
+    deinit {
+        close_dng_negative(handle)
+    }
+}
+
+/**
+ Memory that `read_dng_from_disk_into_buffer` decodes the raw pixels into. The memory is allocated once the size of the image is known and freed together with the object.
+ */
+class PixelBuffer {
+    var bytes: UnsafeMutableRawPointer?
+    var bytes_per_row = 0
+    
+    deinit {
+        bytes?.deallocate()
     }
 }
 
@@ -34,7 +97,7 @@ enum ImageIOError: Error {
 /// Take a list of urls representing non-DNG raw files and converts them using the Adobe DNG Converter.
 /// If the output image already exists, it will not convert it again, unless `override_cache` is set to `true`.
 ///
-/// - Parameter override_cache: Default of `false`. This value should always be set to `true` when outputting the final image.
+/// - Parameter override_cache: Default of `false`. If set to `true`, images are converted again even if a converted version already exists.
 func convert_raws_to_dngs(_ in_urls: [URL], _ dng_converter_path: String, _ tmp_dir: String, _ texture_cache: NSCache<NSString, ImageCacheWrapper>, override_cache: Bool = false) throws -> [URL] {
 
     // create command string
@@ -104,19 +167,49 @@ func convert_raws_to_dngs(_ in_urls: [URL], _ dng_converter_path: String, _ tmp_
 }
 
 
-func image_url_to_texture(_ url: URL, _ device: MTLDevice) throws -> (MTLTexture, Int, Int, [Int], Int, Double, [Double]) {
+func image_url_to_texture(_ url: URL, _ device: MTLDevice) throws -> (MTLTexture, Int, Int, [Int], Int, Double, [Double], DNGNegative?) {
     
     // read image
-    var error_code: Int32
-    var pixel_bytes: UnsafeMutableRawPointer?
+    let negative = try DNGNegative(url)
+    let pixel_buffer = PixelBuffer()
+    
+    // decode the pixels directly into memory owned by pixel_buffer, which avoids an additional copy of the image inside the wrapper
+    let error_code = read_dng_negative_pixels(negative.handle, { context, _, image_height, bytes_per_row in
+        let pixel_buffer = Unmanaged<PixelBuffer>.fromOpaque(context!).takeUnretainedValue()
+        pixel_buffer.bytes_per_row = Int(bytes_per_row!.pointee)
+        pixel_buffer.bytes = UnsafeMutableRawPointer.allocate(byteCount: Int(image_height) * pixel_buffer.bytes_per_row, alignment: 16)
+        return pixel_buffer.bytes
+    }, Unmanaged.passUnretained(pixel_buffer).toOpaque())
+    if (error_code != 0) {throw ImageIOError.load_error}
+    
+    return try negative_to_texture(negative, pixel_buffer.bytes!, pixel_buffer.bytes_per_row, url.lastPathComponent, device)
+}
+
+
+/// Create a texture from the decoded 16-bit pixel values of a raw image.
+func pixels_to_texture(_ pixel_bytes: UnsafeRawPointer, _ width: Int, _ height: Int, _ bytes_per_row: Int, _ label: String, _ device: MTLDevice) throws -> MTLTexture {
+    
+    let texture_descriptor = MTLTextureDescriptor.texture2DDescriptor(pixelFormat: .r16Uint, width: width, height: height, mipmapped: false)
+    texture_descriptor.usage = .shaderRead
+    guard let texture = device.makeTexture(descriptor: texture_descriptor) else {throw ImageIOError.metal_error}
+    texture.label = label
+    
+    texture.replace(region: MTLRegionMake2D(0, 0, width, height), mipmapLevel: 0, withBytes: pixel_bytes, bytesPerRow: bytes_per_row)
+    
+    return texture
+}
+
+
+/// Create a texture from the decoded pixel values of a DNG image and read the metadata of the image. The pixel values have to be decoded with the same negative, so that black levels measured in the masked areas are included.
+func negative_to_texture(_ negative: DNGNegative, _ pixel_bytes: UnsafeRawPointer, _ bytes_per_row: Int, _ label: String, _ device: MTLDevice) throws -> (MTLTexture, Int, Int, [Int], Int, Double, [Double], DNGNegative?) {
+    
+    // read metadata
     var width: Int32 = 0
     var height: Int32 = 0
     var _mosaic_pattern_width: Int32 = 0
     var white_level: Int32 = -1
     // Hardcoding mosaic width of 6, I don't think anything has a mosaic width above 6 (X-Trans sensor)
-    var black_level_from_dng: [Int32]       = [Int32](repeating: -1, count: 6*6)
-    let black_level_from_masked_area: [Int]
-    var black_level: [Int]
+    var black_level: [Int32] = [Int32](repeating: -1, count: 6*6)
     var exposure_bias: Int32 = -1
     var ISO_exposure_time: Float32 = 0.0;
     var color_factor_r: Float32 = -1.0
@@ -130,52 +223,128 @@ func image_url_to_texture(_ url: URL, _ device: MTLDevice) throws -> (MTLTexture
         -1, -1, -1, -1,
         -1, -1, -1, -1]
     
-    error_code = read_dng_from_disk(url.path, &pixel_bytes, &width, &height, &_mosaic_pattern_width, &white_level, &black_level_from_dng, &masked_areas, &exposure_bias, &ISO_exposure_time, &color_factor_r, &color_factor_g, &color_factor_b)
+    let error_code = read_dng_negative_metadata(negative.handle, &width, &height, &_mosaic_pattern_width, &white_level, &black_level, &masked_areas, &exposure_bias, &ISO_exposure_time, &color_factor_r, &color_factor_g, &color_factor_b)
     if (error_code != 0) {throw ImageIOError.load_error}
     
     let mosaic_pattern_width = Int(_mosaic_pattern_width)
     
     // convert image bitmap to MTLTexture
-    let bytes_per_pixel = 2
-    let bytes_per_row = bytes_per_pixel * Int(width)
-    let texture_descriptor = MTLTextureDescriptor.texture2DDescriptor(pixelFormat: .r16Uint, width: Int(width), height: Int(height), mipmapped: false)
-    texture_descriptor.usage = .shaderRead
-    guard let texture = device.makeTexture(descriptor: texture_descriptor) else {throw ImageIOError.metal_error}
-    texture.label = url.lastPathComponent
+    let texture = try pixels_to_texture(pixel_bytes, Int(width), Int(height), bytes_per_row, label, device)
     
-    texture.replace(region: MTLRegionMake2D(0, 0, Int(width), Int(height)), mipmapLevel: 0, withBytes: pixel_bytes!, bytesPerRow: bytes_per_row)
+    // black levels that the DNG reported as 0 have been replaced by the black levels measured in the masked areas while the pixel values were decoded
+    let black_levels = black_level[0..<mosaic_pattern_width*mosaic_pattern_width].map {max(0, Int($0))}
     
+    color_factors[0] = Double(color_factor_r)
+    color_factors[1] = Double(color_factor_g)
+    color_factors[2] = Double(color_factor_b)
     
-    free(pixel_bytes!)
+    return (texture, mosaic_pattern_width, Int(white_level), black_levels, Int(exposure_bias), Double(ISO_exposure_time), color_factors, negative)
+}
 
-    // If any masked areas exist, calculate the black levels from it
-    black_level_from_masked_area = calculate_black_levels(for: texture, from_masked_areas: &masked_areas, mosaic_pattern_width: mosaic_pattern_width)
+
+/// Load the decoded pixel values and metadata of a DNG image from the on-disk frame cache. Returns nil if the cache contains no entry for the image.
+///
+/// The DNG image is not parsed, so the frame has no negative. The negative is only required to save the merged image and is opened for the reference image then.
+func cached_frame_to_texture(_ url: URL, _ cache_dir: String, _ device: MTLDevice) throws -> (MTLTexture, Int, Int, [Int], Int, Double, [Double], DNGNegative?)? {
     
-    // Load black levels either from the values the DNG reported or from the masked area
-    black_level = [Int](repeating: 0, count: mosaic_pattern_width*mosaic_pattern_width)
-    for i in 0..<black_level.count {
-        // 0 is hardcoded as a suspicious black level value.
-        if black_level_from_dng[i] > 0 {
-            black_level[i] = Int(black_level_from_dng[i])
-        } else {
-            black_level[i] = black_level_from_masked_area[i]
-        }
+    var pixel_bytes: UnsafeRawPointer?
+    var width: Int32 = 0
+    var height: Int32 = 0
+    var bytes_per_row: Int32 = 0
+    var mosaic_pattern_width: Int32 = 0
+    var white_level: Int32 = -1
+    var black_level: [Int32] = [Int32](repeating: -1, count: 6*6)
+    var exposure_bias: Int32 = -1
+    var ISO_exposure_time: Float32 = 0.0
+    var color_factor_r: Float32 = -1.0
+    var color_factor_g: Float32 = -1.0
+    var color_factor_b: Float32 = -1.0
+    
+    guard let frame = open_cached_frame(cache_dir, url.path, &pixel_bytes, &width, &height, &bytes_per_row, &mosaic_pattern_width, &white_level, &black_level, &exposure_bias, &ISO_exposure_time, &color_factor_r, &color_factor_g, &color_factor_b) else {return nil}
+    defer {close_cached_frame(frame)}
+    
+    let texture = try pixels_to_texture(pixel_bytes!, Int(width), Int(height), Int(bytes_per_row), url.lastPathComponent, device)
+    
+    let black_levels = black_level[0..<Int(mosaic_pattern_width*mosaic_pattern_width)].map {Int($0)}
+    let color_factors = [Double(color_factor_r), Double(color_factor_g), Double(color_factor_b), 0.0]
+    
+    return (texture, Int(mosaic_pattern_width), Int(white_level), black_levels, Int(exposure_bias), Double(ISO_exposure_time), color_factors, nil)
+}
+
+
+/// Serial queue on which decoded images are written to the on-disk frame cache, so that writing does not delay the decoding and upload of the following images.
+let frame_cache_queue = DispatchQueue(label: "frame cache", qos: .utility)
+
+
+/// Store the decoded pixel values and metadata of a DNG image in the on-disk frame cache, so that the image does not have to be decoded again when it is processed another time. The pixel values are read back from the texture and written in the background.
+func write_frame_to_cache(_ url: URL, _ cache_dir: String, _ frame: (MTLTexture, Int, Int, [Int], Int, Double, [Double], DNGNegative?)) {
+    
+    let (texture, mosaic_pattern_width, white_level, black_levels, exposure_bias, ISO_exposure_time, color_factors, _) = frame
+    let black_level = black_levels.map {Int32($0)}
+    
+    frame_cache_queue.async {
+        let bytes_per_row = texture.width * MemoryLayout<UInt16>.size
+        let pixel_bytes = UnsafeMutableRawPointer.allocate(byteCount: bytes_per_row * texture.height, alignment: 4096)
+        defer {pixel_bytes.deallocate()}
+        texture.getBytes(pixel_bytes, bytesPerRow: bytes_per_row, from: MTLRegionMake2D(0, 0, texture.width, texture.height), mipmapLevel: 0)
+        
+        // a failure only means that the image is decoded again next time
+        _ = write_cached_frame(cache_dir, url.path, pixel_bytes, Int32(texture.width), Int32(texture.height), Int32(bytes_per_row), Int32(mosaic_pattern_width), Int32(white_level), black_level, Int32(exposure_bias), Float32(ISO_exposure_time), Float32(color_factors[0]), Float32(color_factors[1]), Float32(color_factors[2]))
     }
+}
+
+
+/**
+ Decodes the DNG images of a burst with `read_dng_burst_negatives`. The images have been parsed before, they are decoded on a limited number of threads and converted to textures in their original order.
+ */
+class BurstLoader {
+    let device: MTLDevice
+    var indices: [Int] = []
+    var urls: [URL] = []
+    var negatives: [DNGNegative] = []
+    var frames: [(MTLTexture, Int, Int, [Int], Int, Double, [Double], DNGNegative?)] = []
+    // directory of the on-disk frame cache that decoded frames are stored in, if any
+    let frame_cache_dir: String?
     
-    color_factors[0] = Double(color_factor_r)
-    color_factors[1] = Double(color_factor_g)
-    color_factors[2] = Double(color_factor_b)
+    init(_ device: MTLDevice, frame_cache_dir: String? = nil) {
+        self.device = device
+        self.frame_cache_dir = frame_cache_dir
+    }
     
-    return (texture, mosaic_pattern_width, Int(white_level), black_level, Int(exposure_bias), Double(ISO_exposure_time), color_factors)
+    func load() throws {
+        if negatives.isEmpty {return}
+        
+        // decode half as many images at the same time as there are cores, each image is decoded with several threads
+        // - the memory budget limits how many decoded images can wait for their conversion to a texture
+        let worker_count = max(1, ProcessInfo.processInfo.activeProcessorCount / 2)
+        let memory_budget = Int64(0.05 * Double(ProcessInfo.processInfo.physicalMemory))
+        
+        // the handles stay owned by the negatives
+        var handles: [OpaquePointer?] = negatives.map {$0.handle}
+        
+        let error_code = read_dng_burst_negatives(&handles, Int32(negatives.count), Int32(worker_count), memory_budget, { context, index, _, pixel_bytes, width, height, bytes_per_row in
+            let burst = Unmanaged<BurstLoader>.fromOpaque(context!).takeUnretainedValue()
+            let url = burst.urls[Int(index)]
+            let negative = burst.negatives[Int(index)]
+            guard let frame = try? negative_to_texture(negative, pixel_bytes!, Int(bytes_per_row), url.lastPathComponent, burst.device) else {return 1}
+            if let frame_cache_dir = burst.frame_cache_dir {
+                write_frame_to_cache(url, frame_cache_dir, frame)
+            }
+            burst.frames.append(frame)
+            return 0
+        }, Unmanaged.passUnretained(self).toOpaque())
+        if (error_code != 0) {throw ImageIOError.load_error}
+    }
 }
 
 
-func load_images(_ urls: [URL], textureCache: NSCache<NSString, ImageCacheWrapper>) throws -> ([MTLTexture], Int, [Int], [[Int]], [Int], [Double], [[Double]]) {
+/// Load the textures and metadata of DNG images from the in-memory cache, the on-disk frame cache or by decoding them.
+///
+/// The negative of an image is nil if it was loaded from the on-disk frame cache, see `cached_frame_to_texture`.
+func load_images(_ urls: [URL], textureCache: NSCache<NSString, ImageCacheWrapper>, frame_cache_dir: String? = nil) throws -> ([MTLTexture], Int, [Int], [[Int]], [Int], [Double], [[Double]], [DNGNegative?]) {
     
     var textures_dict: [Int: MTLTexture] = [:]
-    let compute_group = DispatchGroup()
-    let compute_queue = DispatchQueue.global() // this is a concurrent queue to do compute
-    let access_queue = DispatchQueue(label: "") // this is a serial queue to read/save data thread-safely
+    var negatives_dict: [Int: DNGNegative?] = [:]
     var mosaic_pattern_width: Int?
     var white_level = Array(repeating: 0, count: urls.count)
     // Setting to
@@ -184,73 +353,85 @@ func load_images(_ urls: [URL], textureCache: NSCache<NSString, ImageCacheWrappe
     var ISO_exposure_time = Array(repeating: 0.0, count: urls.count)
     var color_factors = Array(repeating: Array(repeating: 0.0, count: 3), count: urls.count)
 
+    // images that are not cached are parsed first, so that images with inconsistent resolutions are rejected before spending any time on decoding them
+    // - each image is parsed only once, the burst loader decodes the parsed images
+    var resolutions: [(Int, Int)] = []
+    let burst = BurstLoader(device, frame_cache_dir: frame_cache_dir)
+    var cached_frames: [(Int, (MTLTexture, Int, Int, [Int], Int, Double, [Double], DNGNegative?))] = []
     for i in 0..<urls.count {
         if let cachedValue = textureCache.object(forKey: NSString(string: urls[i].absoluteString)) {
             print("Loading image " + urls[i].lastPathComponent + " from in-memory cache.")
-            access_queue.sync {
-                textures_dict[i] = cachedValue.texture
-                mosaic_pattern_width = cachedValue.mosaic_pattern_width
-                white_level[i] = cachedValue.white_level
-                for j in 0..<cachedValue.black_levels.count {
-                    black_levels[i][j] = cachedValue.black_levels[j]
-                }
-                exposure_bias[i] = cachedValue.exposure_bias
-                ISO_exposure_time[i] = cachedValue.ISO_exposure_time
-                for j in 0..<3 {
-                    color_factors[i][j] = cachedValue.color_factors[j]
-                }
+            resolutions.append((cachedValue.texture.width, cachedValue.texture.height))
+            textures_dict[i] = cachedValue.texture
+            negatives_dict[i] = cachedValue.negative
+            mosaic_pattern_width = cachedValue.mosaic_pattern_width
+            white_level[i] = cachedValue.white_level
+            for j in 0..<cachedValue.black_levels.count {
+                black_levels[i][j] = cachedValue.black_levels[j]
             }
+            exposure_bias[i] = cachedValue.exposure_bias
+            ISO_exposure_time[i] = cachedValue.ISO_exposure_time
+            for j in 0..<3 {
+                color_factors[i][j] = cachedValue.color_factors[j]
+            }
+        } else if let frame_cache_dir = frame_cache_dir, let frame = try cached_frame_to_texture(urls[i], frame_cache_dir, device) {
+            print("Loading image " + urls[i].lastPathComponent + " from on-disk frame cache.")
+            resolutions.append((frame.0.width, frame.0.height))
+            cached_frames.append((i, frame))
         } else {
             print("Loading image " + urls[i].lastPathComponent + " from disk.")
-            compute_queue.async(group: compute_group) {
-                
-                // asynchronously load texture
-                if let (texture, _mosaic_pattern_width, _white_level, _black_levels, _exposure_bias, _ISO_exposure_time, _color_factors) = try? image_url_to_texture(urls[i], device) {
-                    
-                    // thread-safely save the texture
-                    access_queue.sync {
-                        textureCache.setObject(ImageCacheWrapper(texture: texture,
-                                                                 mosaic_pattern_width: _mosaic_pattern_width,
-                                                                 white_level: _white_level,
-                                                                 black_levels: _black_levels,
-                                                                 exposure_bias: _exposure_bias,
-                                                                 ISO_exposure_time: _ISO_exposure_time,
-                                                                 color_factors: _color_factors),
-                                               forKey: NSString(string: urls[i].absoluteString),
-                                               cost: Int(Float(texture.allocatedSize) / 1000 / 1000))
-                        textures_dict[i] = texture
-                        mosaic_pattern_width = _mosaic_pattern_width
-                        white_level[i] = _white_level
-                        for j in 0..<_black_levels.count {
-                            black_levels[i][j] = _black_levels[j]
-                        }
-                        exposure_bias[i] = _exposure_bias
-                        ISO_exposure_time[i] = _ISO_exposure_time
-                        for j in 0..<3 {
-                            color_factors[i][j] = _color_factors[j]
-                        }
-                    }
-                }
-            }
+            let negative = try DNGNegative(urls[i])
+            resolutions.append(try negative.resolution())
+            burst.indices.append(i)
+            burst.urls.append(urls[i])
+            burst.negatives.append(negative)
         }
     }
+    if resolutions.contains(where: {$0 != resolutions[0]}) {
+        throw AlignmentError.inconsistent_resolutions
+    }
     
-    // wait until all the images are loaded
-    compute_group.wait()
+    // decode the images that are not cached
+    // - only a few images are decoded at the same time and each one is uploaded to the GPU as soon as it is its turn, which limits the memory used by decoded images waiting for their upload
+    try burst.load()
+    for (i, frame) in cached_frames + Array(zip(burst.indices, burst.frames)) {
+        let (texture, _mosaic_pattern_width, _white_level, _black_levels, _exposure_bias, _ISO_exposure_time, _color_factors, _negative) = frame
+        
+        textureCache.setObject(ImageCacheWrapper(texture: texture,
+                                                 mosaic_pattern_width: _mosaic_pattern_width,
+                                                 white_level: _white_level,
+                                                 black_levels: _black_levels,
+                                                 exposure_bias: _exposure_bias,
+                                                 ISO_exposure_time: _ISO_exposure_time,
+                                                 color_factors: _color_factors,
+                                                 negative: _negative),
+                               forKey: NSString(string: urls[i].absoluteString),
+                               cost: Int(Float(texture.allocatedSize) / 1000 / 1000))
+        textures_dict[i] = texture
+        negatives_dict[i] = _negative
+        mosaic_pattern_width = _mosaic_pattern_width
+        white_level[i] = _white_level
+        for j in 0..<_black_levels.count {
+            black_levels[i][j] = _black_levels[j]
+        }
+        exposure_bias[i] = _exposure_bias
+        ISO_exposure_time[i] = _ISO_exposure_time
+        for j in 0..<3 {
+            color_factors[i][j] = _color_factors[j]
+        }
+    }
     
     // convert dict to list
     var textures_list: [MTLTexture] = []
+    var negatives_list: [DNGNegative?] = []
     for i in 0..<urls.count {
         
-        // ensure thread-safety
-        try access_queue.sync {
-            
-            // check whether the images have been loaded successfully
-            if let texture = textures_dict[i] {
-                textures_list.append(texture)
-            } else {
-                throw ImageIOError.load_error
-            }
+        // check whether the images have been loaded successfully
+        if let texture = textures_dict[i], let negative = negatives_dict[i] {
+            textures_list.append(texture)
+            negatives_list.append(negative)
+        } else {
+            throw ImageIOError.load_error
         }
     }
     
@@ -270,7 +451,7 @@ func load_images(_ urls: [URL], textureCache: NSCache<NSString, ImageCacheWrappe
         }
     }
     
-    return (textures_list, mosaic_pattern_width!, white_level, black_levels, exposure_bias, ISO_exposure_time, color_factors)
+    return (textures_list, mosaic_pattern_width!, white_level, black_levels, exposure_bias, ISO_exposure_time, color_factors, negatives_list)
 }
 
 
@@ -312,7 +493,10 @@ func safeShell(_ command: String) throws -> String {
 }
 
 
-func texture_to_dng(_ texture: MTLTexture, _ in_url: URL, _ out_url: URL, _ white_level: Int32) throws {
+/// Save a texture as a DNG image. The metadata is taken from the already parsed reference image, so the reference DNG is not read again.
+///
+/// The raw image is compressed with `compression` (lossless JPEG by default, like Adobe DNG Converter). For deflate, `compression_level` selects the zlib level between 1 (fastest) and 9 (smallest), -1 uses the default level.
+func texture_to_dng(_ texture: MTLTexture, _ negative: DNGNegative, _ out_url: URL, _ white_level: Int32, compression: dng_output_compression = dng_output_lossless_jpeg, compression_level: Int32 = -1) throws {
     // synchronize GPU and CPU memory
     let command_buffer = command_queue.makeCommandBuffer()!
     command_buffer.label = "Texture to DNG"
@@ -322,21 +506,16 @@ func texture_to_dng(_ texture: MTLTexture, _ in_url: URL, _ out_url: URL, _ whit
     command_buffer.commit()
     command_buffer.waitUntilCompleted()
     
-    // convert MTLTexture to a bitmap array
-    let width = texture.width
-    let height = texture.height
-    let bytes_per_pixel = 2
-    let bytes_per_row = bytes_per_pixel * width
-    var bytes_pointer: UnsafeMutableRawPointer? = UnsafeMutableRawPointer.allocate(byteCount: width * height * bytes_per_pixel, alignment: 0)
-    let mtl_region = MTLRegionMake2D(0, 0, width, height)
-    texture.getBytes(bytes_pointer!, bytesPerRow: bytes_per_row, from: mtl_region, mipmapLevel: 0)
-
     // save image
-    let error_code = write_dng_to_disk(in_url.path, out_url.path, &bytes_pointer, white_level)
+    // - the tiles of the image are copied straight from the texture into the encoder while it is written, so no copy of the whole image is made
+    var bytes_written: Int64 = 0
+    var encode_time: Double = 0.0
+    let error_code = write_dng_negative_to_disk_from_provider(negative.handle, out_url.path, { context, left, top, width, height, buffer, bytes_per_row in
+        let texture = Unmanaged<AnyObject>.fromOpaque(context!).takeUnretainedValue() as! MTLTexture
+        texture.getBytes(buffer!, bytesPerRow: Int(bytes_per_row), from: MTLRegionMake2D(Int(left), Int(top), Int(width), Int(height)), mipmapLevel: 0)
+    }, Unmanaged.passUnretained(texture as AnyObject).toOpaque(), white_level, compression, compression_level, &bytes_written, &encode_time)
     if (error_code != 0) {throw ImageIOError.save_error}
-    
-    // free memory
-    free(bytes_pointer!)
+    print("Time to encode output image: ", Float(encode_time), "(\(bytes_written / 1_000_000) MB)")
 }
 
 /// Function to ensure that the specified cache directory does not become bigger than the specified size.
@@ -365,7 +544,7 @@ func trim_disk_cache(cache_dir: String, to_max_size max_size: Double) throws {
 
 /// Get all files in the directory, calculate their size (in GB), sort them based on when they were added to the directory, and return the sorted URLs and dates as two arrays.
 ///
-/// Assumes there are no sub-directories in the folder, which for our .dng folder this is true.
+/// Sub-directories are skipped, they are trimmed separately (e.g. the on-disk frame cache in the .dng folder).
 ///
 /// Based on:  https://stackoverflow.com/questions/32814535/how-to-get-directory-size-with-swift-on-os-x
 func size_of_and_chronological_contents_of(directory: URL) -> ([URL], [Double]) {
@@ -373,7 +552,7 @@ func size_of_and_chronological_contents_of(directory: URL) -> ([URL], [Double])
     var dates: [Date] = []
     var sizes: [Double] = []
     do {
-        contents = try FileManager.default.contentsOfDirectory(at: directory, includingPropertiesForKeys: [.fileSizeKey, .addedToDirectoryDateKey])
+        contents = try FileManager.default.contentsOfDirectory(at: directory, includingPropertiesForKeys: [.fileSizeKey, .addedToDirectoryDateKey, .isDirectoryKey])
     } catch {
         return ([], [])
     }
@@ -382,11 +561,15 @@ func size_of_and_chronological_contents_of(directory: URL) -> ([URL], [Double])
     while i < contents.count {
         let fileResourceValue: URLResourceValues
         do {
-            fileResourceValue = try contents[i].resourceValues(forKeys: [.fileSizeKey, .addedToDirectoryDateKey])
+            fileResourceValue = try contents[i].resourceValues(forKeys: [.fileSizeKey, .addedToDirectoryDateKey, .isDirectoryKey])
         } catch {
             contents.remove(at: i)
             continue
         }
+        if fileResourceValue.isDirectory ?? false {
+            contents.remove(at: i)
+            continue
+        }
         i += 1
         
         dates.append(fileResourceValue.addedToDirectoryDate ?? Date(timeIntervalSince1970: 0)) // If it's missing default it to being the oldest file in the directory
@@ -0,0 +1,293 @@
+// stress test of decoding many dng images at the same time
+// - every image is first decoded on the calling thread with a plain dng_host, which does not use any threads
+// - the images are then decoded again by several threads at the same time, each of them decoding its tiles on the shared thread pool,
+//   and with read_dng_burst_from_disk and read_dng_burst_negatives, and all results are compared with the ones of the first decode
+// - this exercises dng_mutex and dng_condition of the DNG SDK, which use the generic pthread implementation on Linux
+// - if no images are given, synthetic bayer images with lossless JPEG compressed tiles and one uncompressed image are written to a temporary directory
+//
+// this is a standalone tool that is not part of the app, it is built and run by "make check" in this directory
+// usage: dng_concurrent_decode_test <thread count> <rounds> [<dng image>...]
+// - returns 0 if all decodes succeeded and matched the single-threaded decode
+
+#include "dng_sdk_wrapper.h"
+#include "dng_camera_profile.h"
+#include "dng_exceptions.h"
+#include "dng_exif.h"
+#include "dng_file_stream.h"
+#include "dng_host.h"
+#include "dng_ifd.h"
+#include "dng_image_writer.h"
+#include "dng_info.h"
+#include "dng_negative.h"
+#include "dng_pixel_buffer.h"
+#include "dng_simple_image.h"
+#include "dng_utils.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+
+// decoded pixel values of an image, rows are tightly packed
+struct decoded_image {
+    int width = 0;
+    int height = 0;
+    std::vector<uint16> pixels;
+};
+
+
+// write a synthetic bayer image of the given size
+// - the pixel values are a gradient with noise from a simple generator, so that the image is deterministic for a seed and compresses like a raw image
+static bool write_synthetic_dng(const char* path, int width, int height, bool uncompressed, uint32 seed) {
+
+    try {
+        dng_host host;
+        host.SetSaveDNGVersion(dngVersion_SaveDefault);
+        AutoPtr<dng_negative> negative(host.Make_dng_negative());
+        negative->SetModelName("Synthetic");
+        negative->SetLocalName("Synthetic");
+        negative->SetColorChannels(3);
+        negative->SetColorKeys(colorKeyRed, colorKeyGreen, colorKeyBlue);
+        negative->SetBayerMosaic(1);
+        negative->SetWhiteLevel(16383);
+        negative->SetBlackLevel(512);
+        negative->SetDefaultCropSize(width, height);
+        negative->SetDefaultCropOrigin(0, 0);
+        dng_vector neutral(3);
+        neutral[0] = 0.5;
+        neutral[1] = 1.0;
+        neutral[2] = 0.7;
+        negative->SetCameraNeutral(neutral);
+        AutoPtr<dng_camera_profile> profile(new dng_camera_profile);
+        profile->SetColorMatrix1(dng_matrix_3by3(1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0));
+        profile->SetCalibrationIlluminant1(lsD65);
+        profile->SetName("Embedded");
+        negative->AddProfile(profile);
+        negative->GetExif()->fISOSpeedRatings[0] = 100;
+        negative->GetExif()->fExposureTime = dng_urational(1, 50);
+
+        AutoPtr<dng_image> image(new dng_simple_image(dng_rect(height, width), 1, ttShort, host.Allocator()));
+        dng_pixel_buffer buffer;
+        ((dng_simple_image*) image.Get())->GetPixelBuffer(buffer);
+        uint32 state = seed;
+        for (int row = 0; row < height; row++) {
+            uint16* pixels = buffer.DirtyPixel_uint16(row, 0);
+            for (int col = 0; col < width; col++) {
+                state = state * 1664525 + 1013904223;
+                pixels[col] = uint16(512 + (row * 7 + col * 13) % 9000 + (state >> 24) + ((row ^ col) & 1) * 300);
+            }
+        }
+        negative->SetStage1Image(image);
+        negative->SynchronizeMetadata();
+
+        dng_file_stream stream(path, true);
+        dng_image_writer writer;
+        writer.WriteDNG(host, stream, *negative.Get(), NULL, dngVersion_SaveDefault, uncompressed);
+        return true;
+    } catch (...) {
+        return false;
+    }
+}
+
+
+// decode the raw image of a dng file without any threads
+static bool decode_single_threaded(const char* path, decoded_image& image) {
+
+    try {
+        dng_file_stream stream(path);
+        dng_host host;
+        dng_info info;
+        info.Parse(host, stream);
+        info.PostParse(host);
+        if (!info.IsValidDNG()) {
+            return false;
+        }
+
+        const dng_ifd& rawIFD = *info.fIFD[info.fMainIndex];
+        dng_simple_image raw_image(rawIFD.Bounds(), rawIFD.fSamplesPerPixel, rawIFD.PixelType(), host.Allocator());
+        rawIFD.ReadImage(host, stream, raw_image);
+
+        const dng_rect& bounds = raw_image.Bounds();
+        image.width = bounds.W();
+        image.height = bounds.H();
+        image.pixels.resize(size_t(image.width) * image.height);
+        dng_pixel_buffer buffer(bounds, 0, 1, ttShort, pcInterleaved, image.pixels.data());
+        raw_image.Get(buffer);
+        return true;
+    } catch (...) {
+        return false;
+    }
+}
+
+
+// dng_pixel_buffer_provider that decodes into a decoded_image
+static void* provide_image_buffer(void* context, int width, int height, int* bytes_per_row) {
+
+    decoded_image& image = *(decoded_image*) context;
+    image.width = width;
+    image.height = height;
+    image.pixels.resize(size_t(width) * height);
+    *bytes_per_row = width * int(sizeof(uint16));
+    return image.pixels.data();
+}
+
+
+static bool equal_pixels(const decoded_image& expected, const void* pixel_bytes, int width, int height, int bytes_per_row) {
+
+    if (width != expected.width || height != expected.height) {
+        return false;
+    }
+    for (int row = 0; row < height; row++) {
+        if (memcmp((const uint8*) pixel_bytes + size_t(row) * bytes_per_row, &expected.pixels[size_t(row) * width], size_t(width) * sizeof(uint16)) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+// state of a read_dng_burst_from_disk or read_dng_burst_negatives call that compares the frames with the single-threaded decodes
+struct burst_check {
+    const std::vector<decoded_image>* expected;
+    int mismatches;
+    // the handles are only owned by the callee with read_dng_burst_from_disk
+    bool close_handles;
+};
+
+
+static int check_burst_frame(void* context, int index, dng_negative_handle* handle, const void* pixel_bytes, int width, int height, int bytes_per_row) {
+
+    burst_check& check = *(burst_check*) context;
+    if (!equal_pixels((*check.expected)[index], pixel_bytes, width, height, bytes_per_row)) {
+        printf("burst frame %d differs from the single-threaded decode\n", index);
+        check.mismatches++;
+    }
+    if (check.close_handles) {
+        close_dng_negative(handle);
+    }
+    return 0;
+}
+
+
+int main(int argc, char** argv) {
+
+    if (argc < 3) {
+        printf("usage: %s <thread count> <rounds> [<dng image>...]\n", argv[0]);
+        return 2;
+    }
+    const int thread_count = Max_int32(atoi(argv[1]), 1);
+    const int rounds = Max_int32(atoi(argv[2]), 1);
+    std::vector<const char*> paths(argv + 3, argv + argc);
+
+    initialize_xmp_sdk();
+
+    // synthetic images of different sizes, the last one is uncompressed
+    std::string synthetic_dir;
+    std::vector<std::string> synthetic_paths;
+    if (paths.empty()) {
+        const char* tmp_dir = getenv("TMPDIR");
+        std::string dir_template = std::string(tmp_dir != NULL && tmp_dir[0] != 0 ? tmp_dir : "/tmp") + "/dng_concurrent_decode_test.XXXXXX";
+        if (mkdtemp(&dir_template[0]) == NULL) {
+            printf("cannot create a temporary directory\n");
+            return 2;
+        }
+        synthetic_dir = dir_template;
+        const int sizes[][2] = {{1024, 768}, {1536, 1024}, {2000, 1500}, {640, 480}, {1200, 900}, {800, 600}};
+        const int size_count = int(sizeof(sizes) / sizeof(sizes[0]));
+        for (int i = 0; i < size_count; i++) {
+            synthetic_paths.push_back(synthetic_dir + "/synthetic_" + std::to_string(i) + ".dng");
+            if (!write_synthetic_dng(synthetic_paths[i].c_str(), sizes[i][0], sizes[i][1], i == size_count - 1, uint32(i + 1))) {
+                printf("cannot write %s\n", synthetic_paths[i].c_str());
+                return 2;
+            }
+        }
+        for (const std::string& path : synthetic_paths) {
+            paths.push_back(path.c_str());
+        }
+    }
+    const int image_count = int(paths.size());
+
+    std::vector<decoded_image> expected(image_count);
+    for (int i = 0; i < image_count; i++) {
+        if (!decode_single_threaded(paths[i], expected[i])) {
+            printf("cannot decode %s\n", paths[i]);
+            return 2;
+        }
+    }
+
+    // every thread decodes all images in each round, starting at a different image, so that the same file is also decoded by several threads at the same time
+    std::atomic<int> failures(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < thread_count; t++) {
+        threads.push_back(std::thread([&, t] {
+            for (int round = 0; round < rounds; round++) {
+                for (int j = 0; j < image_count; j++) {
+                    const int i = (t + j) % image_count;
+                    decoded_image image;
+                    dng_negative_handle* handle = open_dng_negative(paths[i]);
+                    if (handle == NULL || read_dng_negative_pixels(handle, provide_image_buffer, &image) != 0) {
+                        printf("thread %d cannot decode %s\n", t, paths[i]);
+                        failures++;
+                    } else if (!equal_pixels(expected[i], image.pixels.data(), image.width, image.height, image.width * int(sizeof(uint16)))) {
+                        printf("thread %d: %s differs from the single-threaded decode\n", t, paths[i]);
+                        failures++;
+                    }
+                    if (handle != NULL) {
+                        close_dng_negative(handle);
+                    }
+                }
+            }
+        }));
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    for (int round = 0; round < rounds; round++) {
+        burst_check check = {&expected, 0, true};
+        if (read_dng_burst_from_disk(paths.data(), image_count, thread_count, 0, check_burst_frame, &check) != 0) {
+            printf("read_dng_burst_from_disk failed\n");
+            failures++;
+        }
+        failures += check.mismatches;
+    }
+
+    // the images are parsed before the burst is read, like the app does to check their resolutions
+    for (int round = 0; round < rounds; round++) {
+        std::vector<dng_negative_handle*> handles(image_count);
+        bool opened = true;
+        for (int i = 0; i < image_count; i++) {
+            handles[i] = open_dng_negative(paths[i]);
+            opened = opened && handles[i] != NULL;
+        }
+        burst_check check = {&expected, 0, false};
+        if (!opened || read_dng_burst_negatives(handles.data(), image_count, thread_count, 0, check_burst_frame, &check) != 0) {
+            printf("read_dng_burst_negatives failed\n");
+            failures++;
+        }
+        failures += check.mismatches;
+        for (dng_negative_handle* handle : handles) {
+            if (handle != NULL) {
+                close_dng_negative(handle);
+            }
+        }
+    }
+
+    terminate_xmp_sdk();
+
+    for (const std::string& path : synthetic_paths) {
+        unlink(path.c_str());
+    }
+    if (!synthetic_dir.empty()) {
+        rmdir(synthetic_dir.c_str());
+    }
+
+    printf("%d images, %d threads, %d rounds: %s\n", image_count, thread_count, rounds, failures == 0 ? "all decodes match" : "FAILED");
+    return failures == 0 ? 0 : 1;
+}
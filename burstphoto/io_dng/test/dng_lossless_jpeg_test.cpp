@@ -0,0 +1,344 @@
+// test of decoding large lossless JPEG images on several threads (dng_lossless_decoder::FinishReadInParts)
+// - every image is large enough to be decoded in parts, and is decoded without a host, which decodes it on the calling thread,
+//   and with dng_threaded_host and several thread counts, and all results are compared with the original samples
+// - images without restart intervals are decoded by dng_lossless_speculative_task, they are written by the encoder of the
+//   DNG SDK and by the encoder of this test, which also supports all predictors
+// - images with restart intervals are decoded by dng_lossless_restart_task, they are written by the encoder of this test,
+//   because the encoder of the DNG SDK does not write restart intervals
+// - each image is decoded from memory, at an offset into a larger buffer, and from a file, which is read into memory in parts
+//
+// this is a standalone tool that is not part of the app, it is built and run by "make check" in this directory
+// usage: dng_lossless_jpeg_test
+// - returns 0 if all decodes matched the original samples
+
+#include "dng_threaded_host.h"
+#include "dng_exceptions.h"
+#include "dng_file_stream.h"
+#include "dng_lossless_jpeg.h"
+#include "dng_memory.h"
+#include "dng_memory_stream.h"
+#include "dng_stream.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+
+// interleaved samples of an image
+struct sample_image {
+    int width;
+    int height;
+    int components;
+    int bits;
+    std::vector<uint16> samples;
+};
+
+
+// spooler that collects the decoded samples
+class sample_spooler : public dng_spooler {
+
+public:
+    std::vector<uint16> samples;
+
+    virtual void Spool(const void* data, uint32 count) {
+        const uint16* first = (const uint16*) data;
+        samples.insert(samples.end(), first, first + count / sizeof(uint16));
+    }
+};
+
+
+// image with smooth gradients and noise of the given amplitude, or uniformly random samples if noise is 0
+static sample_image make_image(int width, int height, int components, int bits, int noise, uint32 seed) {
+
+    sample_image image = {width, height, components, bits, std::vector<uint16>(size_t(width) * height * components)};
+    const int max_value = (1 << bits) - 1;
+    uint32 state = seed;
+    for (int row = 0; row < height; row++) {
+        for (int i = 0; i < width * components; i++) {
+            state = state * 1664525 + 1013904223;
+            int value;
+            if (noise == 0) {
+                value = int(state >> 16) & max_value;
+            } else {
+                value = (row * 7 + i * 13) % (max_value / 2 + 1) + int(state >> 16) % (noise + 1) - noise / 2;
+            }
+            image.samples[size_t(row) * width * components + i] = uint16(value < 0 ? 0 : value > max_value ? max_value : value);
+        }
+    }
+    return image;
+}
+
+
+// writes bits to a lossless JPEG scan, with stuffed zero bytes after 0xFF
+class scan_writer {
+
+public:
+    explicit scan_writer(std::vector<uint8>& bytes) : bytes(bytes), buffer(0), count(0) {}
+
+    void put(uint32 value, int bit_count) {
+        for (int i = bit_count - 1; i >= 0; i--) {
+            buffer = (buffer << 1) | ((value >> i) & 1);
+            if (++count == 8) {
+                bytes.push_back(uint8(buffer));
+                if (buffer == 0xFF) {
+                    bytes.push_back(0);
+                }
+                buffer = 0;
+                count = 0;
+            }
+        }
+    }
+
+    // pads the last byte with ones, as required before a marker
+    void flush() {
+        while (count != 0) {
+            put(1, 1);
+        }
+    }
+
+private:
+    std::vector<uint8>& bytes;
+    uint32 buffer;
+    int count;
+};
+
+
+// encodes an image with one of the predictors 1-7 and a restart marker every restart_rows rows (0 for no restart intervals)
+// - all components use one fixed Huffman table that has a code for each of the 17 difference categories
+static std::vector<uint8> encode_image(const sample_image& image, int predictor, int restart_rows) {
+
+    // number of codes of each length from 1 to 16 bits, the codes of the categories are assigned in order
+    static const uint8 code_counts[16] = {0, 2, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0};
+    uint32 codes[17];
+    int code_lengths[17];
+    uint32 code = 0;
+    int category = 0;
+    for (int length = 1; length <= 16; length++) {
+        for (int i = 0; i < code_counts[length - 1]; i++) {
+            codes[category] = code++;
+            code_lengths[category] = length;
+            category++;
+        }
+        code <<= 1;
+    }
+
+    std::vector<uint8> bytes;
+    auto put_uint16 = [&bytes](int value) {
+        bytes.push_back(uint8(value >> 8));
+        bytes.push_back(uint8(value));
+    };
+    const int components = image.components;
+
+    // start of image, frame header, Huffman table, restart interval and scan header
+    put_uint16(0xFFD8);
+    put_uint16(0xFFC3);
+    put_uint16(8 + 3 * components);
+    bytes.push_back(uint8(image.bits));
+    put_uint16(image.height);
+    put_uint16(image.width);
+    bytes.push_back(uint8(components));
+    for (int c = 0; c < components; c++) {
+        bytes.push_back(uint8(c));
+        bytes.push_back(0x11);
+        bytes.push_back(0);
+    }
+    put_uint16(0xFFC4);
+    put_uint16(2 + 1 + 16 + 17);
+    bytes.push_back(0);
+    bytes.insert(bytes.end(), code_counts, code_counts + 16);
+    for (int i = 0; i < 17; i++) {
+        bytes.push_back(uint8(i));
+    }
+    if (restart_rows > 0) {
+        put_uint16(0xFFDD);
+        put_uint16(4);
+        put_uint16(restart_rows * image.width);
+    }
+    put_uint16(0xFFDA);
+    put_uint16(6 + 2 * components);
+    bytes.push_back(uint8(components));
+    for (int c = 0; c < components; c++) {
+        bytes.push_back(uint8(c));
+        bytes.push_back(0);
+    }
+    bytes.push_back(uint8(predictor));
+    bytes.push_back(0);
+    bytes.push_back(0);
+
+    scan_writer writer(bytes);
+    int restart_index = 0;
+    const int row_size = image.width * components;
+    for (int row = 0; row < image.height; row++) {
+        // the first row of the scan and of each restart interval is predicted from the left only
+        const bool first_row = row == 0 || (restart_rows > 0 && row % restart_rows == 0);
+        if (first_row && row > 0) {
+            writer.flush();
+            put_uint16(0xFFD0 + restart_index);
+            restart_index = (restart_index + 1) & 7;
+        }
+        const uint16* current = &image.samples[size_t(row) * row_size];
+        const uint16* above = first_row ? NULL : current - row_size;
+        for (int col = 0; col < image.width; col++) {
+            for (int c = 0; c < components; c++) {
+                const int i = col * components + c;
+                int32 prediction;
+                if (first_row) {
+                    prediction = col == 0 ? 1 << (image.bits - 1) : current[i - components];
+                } else if (col == 0) {
+                    prediction = above[i];
+                } else {
+                    const int32 left = current[i - components];
+                    const int32 upper = above[i];
+                    const int32 diag = above[i - components];
+                    switch (predictor) {
+                        case 1: prediction = left; break;
+                        case 2: prediction = upper; break;
+                        case 3: prediction = diag; break;
+                        case 4: prediction = left + upper - diag; break;
+                        case 5: prediction = left + ((upper - diag) >> 1); break;
+                        case 6: prediction = upper + ((left - diag) >> 1); break;
+                        default: prediction = (left + upper) >> 1; break;
+                    }
+                }
+
+                // the difference is taken modulo 2^16, -32768 has a category of its own without additional bits
+                int32 difference = int32(uint16(current[i] - prediction));
+                if (difference >= 0x8000) {
+                    difference -= 0x10000;
+                }
+                int32 magnitude = difference < 0 ? -difference : difference;
+                int category = 0;
+                while (magnitude != 0) {
+                    category++;
+                    magnitude >>= 1;
+                }
+                writer.put(codes[category], code_lengths[category]);
+                if (category > 0 && category < 16) {
+                    writer.put(uint32(difference < 0 ? difference + (1 << category) - 1 : difference), category);
+                }
+            }
+        }
+    }
+    writer.flush();
+    put_uint16(0xFFD9);
+    return bytes;
+}
+
+
+// encodes an image with the encoder of the DNG SDK, which uses predictor 1 and no restart intervals
+static std::vector<uint8> encode_image_sdk(const sample_image& image) {
+
+    dng_memory_stream stream(gDefaultDNGMemoryAllocator);
+    EncodeLosslessJPEG<Scalar>(image.samples.data(), image.height, image.width, image.components, image.bits,
+                               image.width * image.components, image.components, stream);
+    std::vector<uint8> bytes(size_t(stream.Length()));
+    stream.SetReadPosition(0);
+    stream.Get(bytes.data(), uint32(bytes.size()));
+    return bytes;
+}
+
+
+// decodes an image that starts at the given offset of the stream and ends at the end of the stream, with the host, or on the calling thread if host is NULL
+static bool decode_image(dng_stream& stream, uint64 offset, dng_host* host, std::vector<uint16>& samples) {
+
+    try {
+        sample_spooler spooler;
+        stream.SetReadPosition(offset);
+        DecodeLosslessJPEG<Scalar>(stream, spooler, 0, 0xFFFFFFFF, false, stream.Length(), host);
+        samples.swap(spooler.samples);
+        return true;
+    } catch (...) {
+        return false;
+    }
+}
+
+
+int main() {
+
+    // the pool has more threads than the largest thread count of the tests, even on machines with few cores
+    const uint32 thread_counts[] = {2, 3, 8, 16};
+    dng_thread_pool::initialize_shared(16);
+
+    struct test_case {
+        const char* name;
+        sample_image image;
+        int predictor;      // 0 uses the encoder of the DNG SDK
+        int restart_rows;
+    };
+    std::vector<test_case> cases;
+    cases.push_back({"sdk encoder, 2 components, 14 bits", make_image(1024, 640, 2, 14, 200, 1), 0, 0});
+    cases.push_back({"sdk encoder, 2 components, 14 bits, little noise", make_image(1536, 512, 2, 14, 8, 2), 0, 0});
+    cases.push_back({"sdk encoder, 1 component, 16 bits, random", make_image(1001, 1100, 1, 16, 0, 3), 0, 0});
+    cases.push_back({"sdk encoder, 4 components, 12 bits", make_image(640, 480, 4, 12, 50, 4), 0, 0});
+    for (int predictor = 1; predictor <= 7; predictor++) {
+        cases.push_back({"no restart intervals", make_image(1024, 560, 2, 14, 300, 10 + predictor), predictor, 0});
+    }
+    cases.push_back({"restart interval of 1 row, 2 components", make_image(1024, 640, 2, 14, 200, 20), 1, 1});
+    cases.push_back({"restart interval of 7 rows, 2 components", make_image(1024, 640, 2, 14, 200, 21), 1, 7});
+    cases.push_back({"restart interval of 64 rows, 2 components, does not divide the height", make_image(1000, 700, 2, 14, 200, 22), 1, 64});
+    cases.push_back({"restart interval of 3 rows, 1 component, 16 bits, random", make_image(1200, 1000, 1, 16, 0, 23), 1, 3});
+    cases.push_back({"restart interval of 5 rows, 3 components", make_image(800, 500, 3, 12, 40, 24), 1, 5});
+    for (int predictor = 2; predictor <= 7; predictor++) {
+        cases.push_back({"restart interval of 2 rows", make_image(1024, 560, 2, 14, 300, 30 + predictor), predictor, 2});
+    }
+
+    const char* tmp_dir = getenv("TMPDIR");
+    std::string file_path = std::string(tmp_dir != NULL && tmp_dir[0] != 0 ? tmp_dir : "/tmp") + "/dng_lossless_jpeg_test.XXXXXX";
+    const int file = mkstemp(&file_path[0]);
+    if (file < 0) {
+        printf("cannot create a temporary file\n");
+        return 2;
+    }
+    close(file);
+
+    int failures = 0;
+    for (const test_case& test : cases) {
+        const sample_image& image = test.image;
+        std::vector<uint8> bytes = test.predictor == 0 ? encode_image_sdk(image) : encode_image(image, test.predictor, test.restart_rows);
+        const double decoded_size = image.samples.size() * sizeof(uint16) / 1048576.0;
+        printf("%s, predictor %d: %dx%d, %.1f MB compressed, %.1f MB decoded\n",
+               test.name, test.predictor == 0 ? 1 : test.predictor, image.width, image.height, bytes.size() / 1048576.0, decoded_size);
+
+        // the image is decoded at an offset, which the decoder has to add to the positions of the parts
+        const uint32 offset = 4099;
+        std::vector<uint8> buffer(offset, 0xA5);
+        buffer.insert(buffer.end(), bytes.begin(), bytes.end());
+        FILE* output = fopen(file_path.c_str(), "wb");
+        if (output == NULL || fwrite(buffer.data(), 1, buffer.size(), output) != buffer.size() || fclose(output) != 0) {
+            printf("cannot write %s\n", file_path.c_str());
+            return 2;
+        }
+
+        for (int from_file = 0; from_file < 2; from_file++) {
+            AutoPtr<dng_stream> stream(from_file ? new dng_file_stream(file_path.c_str()) : new dng_stream(buffer.data(), uint32(buffer.size())));
+            const char* source = from_file ? "file" : "memory";
+
+            std::vector<uint16> expected;
+            if (!decode_image(*stream.Get(), offset, NULL, expected) || expected != image.samples) {
+                printf("  FAILED: single-threaded decode from %s differs from the original samples\n", source);
+                failures++;
+                continue;
+            }
+            for (uint32 thread_count : thread_counts) {
+                dng_threaded_host host(NULL, NULL, thread_count);
+                std::vector<uint16> samples;
+                if (!decode_image(*stream.Get(), offset, &host, samples)) {
+                    printf("  FAILED: decode from %s with %u threads threw an exception\n", source, thread_count);
+                    failures++;
+                } else if (samples != expected) {
+                    printf("  FAILED: decode from %s with %u threads differs from the single-threaded decode\n", source, thread_count);
+                    failures++;
+                }
+            }
+        }
+    }
+    unlink(file_path.c_str());
+
+    dng_thread_pool::terminate_shared();
+
+    printf("%d images: %s\n", int(cases.size()), failures == 0 ? "all decodes match" : "FAILED");
+    return failures == 0 ? 0 : 1;
+}
@@ -719,27 +719,6 @@ kernel void sum_rect_columns_float(texture2d<float, access::read> in_texture [[t
     out_texture.write(total, gid);
 }
 
-/**
- Used for calculating a black level from masked areas of the DNG.
- DNG data is storred as UInt, thus need a seperate version from the float one above.
- */
-kernel void sum_rect_columns_uint(texture2d<uint, access::read> in_texture [[texture(0)]],
-                                  texture2d<float, access::write> out_texture [[texture(1)]],
-                                  constant int& top [[buffer(0)]],
-                                  constant int& left [[buffer(1)]],
-                                  constant int& bottom [[buffer(2)]],
-                                  constant int& mosaic_pattern_width [[buffer(3)]],
-                                  uint2 gid [[thread_position_in_grid]]) {
-    uint x = left + gid.x;
-    
-    float total = 0;
-    for (int y = top + gid.y; y < bottom; y += mosaic_pattern_width) {
-        total += in_texture.read(uint2(x, y)).r;
-    }
-
-    out_texture.write(total, gid);
-}
-
 
 kernel void sum_row(texture2d<float, access::read> in_texture [[texture(0)]],
                     device float *out_buffer [[buffer(0)]],
@@ -22,7 +22,6 @@ let find_hotpixels_xtrans_state         = create_pipeline(with_function_name: "f
 let normalize_texture_state             = create_pipeline(with_function_name: "normalize_texture",              and_label: "Normalize Texture")
 let prepare_texture_bayer_state         = create_pipeline(with_function_name: "prepare_texture_bayer",          and_label: "Prepare Texture (Bayer)")
 let sum_rect_columns_float_state        = create_pipeline(with_function_name: "sum_rect_columns_float",         and_label: "Sum Along Columns Inside A Rect (Float)")
-let sum_rect_columns_uint_state         = create_pipeline(with_function_name: "sum_rect_columns_uint",          and_label: "Sum Along Columns Inside A Rect (UInt)")
 let sum_row_state                       = create_pipeline(with_function_name: "sum_row",                        and_label: "Sum Along Rows")
 let upsample_bilinear_float_state       = create_pipeline(with_function_name: "upsample_bilinear_float",        and_label: "Upsample (Bilinear) (Float)")
 let upsample_nearest_int_state          = create_pipeline(with_function_name: "upsample_nearest_int",           and_label: "Upsample (Nearest Neighbour) (Int)")
@@ -192,84 +191,6 @@ func blur(_ in_texture: MTLTexture, with_pattern_width mosaic_pattern_width: Int
 }
 
 
-/// Calculate the sum of each subpixel in the mosaic pattern within the specified region.
-/// Returns and array of length mosaic\_pattern\_width^2 which is to be treated as a flattened 2D array: 2D(x, y) == 1D(x + width\*y)
-func calculate_black_levels(for texture: MTLTexture, from_masked_areas masked_areas: UnsafeMutablePointer<Int32>, mosaic_pattern_width: Int) -> [Int] {
-    var num_pixels: Float = 0.0
-    var command_buffers: [MTLCommandBuffer] = []
-    var black_level_buffers: [MTLBuffer] = []
-    var black_level_from_masked_area = [Float](repeating: 0.0, count: Int(mosaic_pattern_width*mosaic_pattern_width))
-    
-    for i in 0..<4 {
-        // Up to 4 masked areas exist, as soon as we reach -1 we know there are no more masked areas after.
-        if masked_areas[4*i] == -1 { break }
-        let top     = masked_areas[4*i + 0]
-        let left    = masked_areas[4*i + 1]
-        let bottom  = masked_areas[4*i + 2]
-        let right   = masked_areas[4*i + 3]
-        
-        num_pixels += Float((bottom - top) * (right - left))
-        
-        // Create output texture from the y-axis blurring
-        let texture_descriptor = MTLTextureDescriptor.texture2DDescriptor(pixelFormat: .r32Float, width: Int(right - left), height: mosaic_pattern_width, mipmapped: false)
-        texture_descriptor.usage = [.shaderRead, .shaderWrite]
-        texture_descriptor.storageMode = .private
-        let summed_y = device.makeTexture(descriptor: texture_descriptor)!
-        summed_y.label = "\(texture.label!.components(separatedBy: ":")[0]): Summed in y for black level"
-        
-        // Sum along columns
-        let command_buffer = command_queue.makeCommandBuffer()!
-        command_buffer.label = "Black Levels \(i) for \(String(describing: texture.label!))"
-        let command_encoder = command_buffer.makeComputeCommandEncoder()!
-        command_encoder.label = command_buffer.label
-        command_encoder.setComputePipelineState(sum_rect_columns_uint_state)
-        let thread_groups_per_grid = MTLSize(width: summed_y.width, height: summed_y.height, depth: 1)
-        let threads_per_thread_group = get_threads_per_thread_group(sum_rect_columns_uint_state, thread_groups_per_grid)
-        
-        command_encoder.setTexture(texture, index: 0)
-        command_encoder.setTexture(summed_y, index: 1)
-        command_encoder.setBytes([top], length: MemoryLayout<Int32>.stride, index: 1)
-        command_encoder.setBytes([left], length: MemoryLayout<Int32>.stride, index: 2)
-        command_encoder.setBytes([bottom], length: MemoryLayout<Int32>.stride, index: 3)
-        command_encoder.setBytes([Int32(mosaic_pattern_width)], length: MemoryLayout<Int32>.stride, index: 4)
-        command_encoder.dispatchThreads(thread_groups_per_grid, threadsPerThreadgroup: threads_per_thread_group)
-        command_encoder.popDebugGroup()
-        
-        // Sum along the row
-        let sum_buffer = device.makeBuffer(length: (mosaic_pattern_width*mosaic_pattern_width)*MemoryLayout<Float32>.size,
-                                           options: .storageModeShared)!
-        sum_buffer.label = "\(texture.label!.components(separatedBy: ":")[0]): Black Levels from masked area \(i)"
-        command_encoder.setComputePipelineState(sum_row_state)
-        command_encoder.setTexture(summed_y, index: 0)
-        command_encoder.setBuffer(sum_buffer, offset: 0, index: 0)
-        command_encoder.setBytes([Int32(summed_y.width)], length: MemoryLayout<Int32>.stride, index: 1)
-        command_encoder.setBytes([Int32(mosaic_pattern_width)], length: MemoryLayout<Int32>.stride, index: 2)
-        let threads_per_grid_x = MTLSize(width: mosaic_pattern_width, height: mosaic_pattern_width, depth: 1)
-        command_encoder.dispatchThreads(threads_per_grid_x, threadsPerThreadgroup: threads_per_thread_group)
-        command_encoder.endEncoding()
-        command_buffer.commit()
-        
-        command_buffers.append(command_buffer)
-        black_level_buffers.append(sum_buffer)
-    }
-    
-    if num_pixels > 0 {
-        // E.g. if a masked area is 2x2 and we're using a bayer image (2x2 RGGB mosaic pattern), while there are 4 pixels in the masked area, each subpixel (R, G, G, or B) actually only has 1/4 (1 / mosaic_width^2) that number of pixels.
-         num_pixels /= Float(mosaic_pattern_width*mosaic_pattern_width)
-        
-        for i in 0..<command_buffers.count {
-            command_buffers[i].waitUntilCompleted()
-            let _this_black_levels = black_level_buffers[i].contents().bindMemory(to: Float32.self, capacity: 1)
-            for j in 0..<black_level_from_masked_area.count {
-                black_level_from_masked_area[j] += _this_black_levels[j] / num_pixels
-            }
-        }
-    }
-    
-    return black_level_from_masked_area.map { Int(round($0)) }
-}
-
-
 func calculate_weight_highlights(_ in_texture: MTLTexture, _ exposure_bias: Int, _ white_level: Int, _ black_level_mean: Double) -> MTLTexture {
     
     let weight_highlights_texture_descriptor = MTLTextureDescriptor.texture2DDescriptor(pixelFormat: .r32Float, width: in_texture.width, height: in_texture.height, mipmapped: false)
@@ -20,7 +20,11 @@
 
 dng_area_task::dng_area_task (const char *name)
 
-	:	fMaxThreads	  (kMaxMPThreads)
+	// Burst Photo modified: per-thread buffers of the SDK tasks are sized by
+	// the thread count passed to Start, so by default a task uses as many
+	// threads as the host provides instead of at most kMaxMPThreads.
+
+	:	fMaxThreads	  (0xFFFFFFFF)
 	
 	,	fMinTaskArea  (256 * 256)
 	
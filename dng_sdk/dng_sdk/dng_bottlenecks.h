@@ -580,7 +580,8 @@ typedef void (DecodeLosslessJPEGProc) (dng_stream &stream,
 									   uint32 minDecodedSize,
 									   uint32 maxDecodedSize,
 									   bool bug16,
-									   uint64 endOfData);
+									   uint64 endOfData,
+									   dng_host *host);		// Burst Photo modified (added)
 
 typedef void (EncodeLosslessJPEGProc) (const uint16 *srcData,
 									   uint32 srcRows,
@@ -1788,7 +1789,8 @@ inline void DoDecodeLosslessJPEG (dng_stream &stream,
 								  uint32 minDecodedSize,
 								  uint32 maxDecodedSize,
 								  bool bug16,
-								  uint64 endOfData)
+								  uint64 endOfData,
+								  dng_host *host = NULL)	// Burst Photo modified (added)
 	{
 	
 	(gDNGSuite.DecodeLosslessJPEG) (stream,
@@ -1796,7 +1798,8 @@ inline void DoDecodeLosslessJPEG (dng_stream &stream,
 									minDecodedSize,
 									maxDecodedSize,
 									bug16,
-									endOfData);
+									endOfData,
+									host);
 	
 	}
 
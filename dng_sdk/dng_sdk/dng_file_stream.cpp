@@ -11,7 +11,8 @@
 #include "dng_exceptions.h"
 #include "dng_flags.h"
 
-#if qAndroid
+#if qMacOS || qLinux || qAndroid
+#include <errno.h>
 #include <unistd.h>
 #endif
 
@@ -229,6 +230,49 @@ void dng_file_stream::DoRead (void *data,
 		
 /*****************************************************************************/
 
+#if qMacOS || qLinux || qAndroid
+
+void dng_file_stream::DoReadAt (void *data,
+								uint32 count,
+								uint64 offset)
+	{
+	
+	int fileDescriptor = fileno (fFile);
+	
+	uint8 *dPtr = (uint8 *) data;
+	
+	while (count)
+		{
+		
+		ssize_t bytesRead = pread (fileDescriptor,
+								   dPtr,
+								   count,
+								   (off_t) offset);
+		
+		if (bytesRead < 0 && errno == EINTR)
+			{
+			continue;
+			}
+			
+		if (bytesRead <= 0)
+			{
+			
+			ThrowReadFile ();
+			
+			}
+			
+		dPtr   += bytesRead;
+		count  -= (uint32) bytesRead;
+		offset += (uint64) bytesRead;
+		
+		}
+	
+	}
+
+#endif
+		
+/*****************************************************************************/
+
 void dng_file_stream::DoWrite (const void *data,
 							   uint32 count,
 							   uint64 offset)
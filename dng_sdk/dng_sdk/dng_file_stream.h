@@ -17,6 +17,7 @@
 
 /*****************************************************************************/
 
+#include "dng_flags.h"
 #include "dng_stream.h"
 
 /*****************************************************************************/
@@ -68,6 +69,18 @@ class dng_file_stream: public dng_stream
 		#endif	// qWinOS
 		
 		virtual ~dng_file_stream ();
+		
+		#if qMacOS || qLinux || qAndroid
+		
+		// Burst Photo modified (added): positional reads use pread, which
+		// does not share a file position between threads.
+		
+		virtual bool SupportsConcurrentReads () const
+			{
+			return true;
+			}
+		
+		#endif
 	
 	protected:
 	
@@ -81,6 +94,14 @@ class dng_file_stream: public dng_stream
 							  uint32 count,
 							  uint64 offset);
 		
+		#if qMacOS || qLinux || qAndroid
+		
+		virtual void DoReadAt (void *data,
+							   uint32 count,
+							   uint64 offset);
+		
+		#endif
+		
 	};
 		
 /*****************************************************************************/
@@ -70,6 +70,10 @@ void dng_filter_task::Start (uint32 threadCount,
 											  fDstPlanes, 
 											  padSIMDBytes);
 						   
+	fSrcBuffer.Reset (threadCount);
+	
+	fDstBuffer.Reset (threadCount);
+	
 	for (uint32 threadIndex = 0; threadIndex < threadCount; threadIndex++)
 		{
 		
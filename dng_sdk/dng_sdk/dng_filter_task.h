@@ -49,8 +49,11 @@ class dng_filter_task: public dng_area_task
 		dng_point fSrcRepeat;
 		dng_point fSrcTileSize;
 		
-		AutoPtr<dng_memory_block> fSrcBuffer [kMaxMPThreads];
-		AutoPtr<dng_memory_block> fDstBuffer [kMaxMPThreads];
+		// Burst Photo modified: per-thread buffers are sized by the actual
+		// thread count in Start, instead of kMaxMPThreads.
+
+		AutoArray<AutoPtr<dng_memory_block> > fSrcBuffer;
+		AutoArray<AutoPtr<dng_memory_block> > fDstBuffer;
 		
 	public:
 	
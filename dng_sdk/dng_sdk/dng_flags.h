@@ -311,9 +311,11 @@
 
 /// \def qDNGThreadSafe 
 /// 1 if target platform has thread support and threadsafe libraries, 0 otherwise.
+/// Burst Photo modified: also enabled on Linux, where dng_mutex and
+/// dng_condition use the generic POSIX path of dng_pthread.
 
 #ifndef qDNGThreadSafe
-#define qDNGThreadSafe (qMacOS || qWinOS)
+#define qDNGThreadSafe (qMacOS || qWinOS || qLinux)
 #endif
 
 /*****************************************************************************/
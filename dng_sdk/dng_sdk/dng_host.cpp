@@ -22,6 +22,7 @@
 #include "dng_resample.h"
 #include "dng_shared.h"
 #include "dng_simple_image.h"
+#include "dng_utils.h"
 
 #if qDNGUseXMP
 #include "dng_xmp.h"
@@ -49,6 +50,7 @@ dng_host::dng_host (dng_memory_allocator *allocator,
 	,	fForFastSaveToDNG	(false)
 	,	fFastSaveToDNGSize	(0)
 	,	fPreserveStage2		(false)
+	,	fPerfCounters		(NULL)
 	
 	{
 	
@@ -63,6 +65,73 @@ dng_host::~dng_host ()
 	
 /*****************************************************************************/
 
+// Burst Photo modified (added)
+
+void dng_perf_counters::AddTime (std::atomic<uint64> &counter,
+								 real64 startTime)
+	{
+	
+	real64 elapsed = TickTimeInSeconds () - startTime;
+	
+	counter += (uint64) (Max_real64 (elapsed, 0.0) * 1.0e9);
+	
+	}
+	
+/*****************************************************************************/
+
+// Burst Photo modified (added)
+
+dng_perf_tile_scope::dng_perf_tile_scope (dng_perf_counters *counters,
+										  uint64 tileBytes)
+
+	:	fCounters  (counters)
+	,	fStartTime (0.0)
+	
+	{
+	
+	if (fCounters)
+		{
+		
+		fStartTime = TickTimeInSeconds ();
+		
+		fCounters->fTiles++;
+		
+		fCounters->fTileBytes += tileBytes;
+		
+		}
+	
+	}
+	
+/*****************************************************************************/
+
+dng_perf_tile_scope::~dng_perf_tile_scope ()
+	{
+	
+	if (fCounters)
+		{
+		
+		dng_perf_counters::AddTime (fCounters->fTileNanoseconds, fStartTime);
+		
+		}
+	
+	}
+	
+/*****************************************************************************/
+
+void dng_perf_tile_scope::AddTileBytes (uint64 tileBytes)
+	{
+	
+	if (fCounters)
+		{
+		
+		fCounters->fTileBytes += tileBytes;
+		
+		}
+	
+	}
+	
+/*****************************************************************************/
+
 dng_memory_allocator & dng_host::Allocator ()
 	{
 	
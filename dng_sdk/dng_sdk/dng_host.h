@@ -24,6 +24,87 @@
 #include "dng_types.h"
 #include "dng_uncopyable.h"
 
+#include <atomic>
+
+/*****************************************************************************/
+
+/// \brief Burst Photo modified (added): Counters of the tiles that are read
+/// and written with a host. The tiles may be processed on several threads at
+/// the same time, so all counters are atomic. Times are in nanoseconds and
+/// are summed over all threads.
+
+class dng_perf_counters: private dng_uncopyable
+	{
+	
+	public:
+	
+		/// Number of tiles read or written.
+		
+		std::atomic<uint64> fTiles;
+		
+		/// Number of compressed bytes of the tiles read or written.
+		
+		std::atomic<uint64> fTileBytes;
+		
+		/// Time spent reading or writing tiles, including moving the pixel
+		/// values between the image and the tile buffers.
+		
+		std::atomic<uint64> fTileNanoseconds;
+		
+		/// Time spent moving the pixel values between the image and the tile
+		/// buffers. It is measured when tiles are written. When tiles are read,
+		/// the pixel values are put into the image from inside the decoders, so
+		/// it is only known to images that measure it themselves.
+		
+		std::atomic<uint64> fCopyNanoseconds;
+		
+	public:
+	
+		dng_perf_counters ()
+			:	fTiles			 (0)
+			,	fTileBytes		 (0)
+			,	fTileNanoseconds (0)
+			,	fCopyNanoseconds (0)
+			{
+			}
+			
+		/// Add the time in seconds since a start time returned by
+		/// TickTimeInSeconds to a counter.
+		
+		static void AddTime (std::atomic<uint64> &counter,
+							 real64 startTime);
+		
+	};
+
+/*****************************************************************************/
+
+/// \brief Burst Photo modified (added): Counts a tile that is read or written
+/// and the time until the object goes out of scope. Does nothing if the
+/// counters are NULL.
+
+class dng_perf_tile_scope: private dng_uncopyable
+	{
+	
+	private:
+	
+		dng_perf_counters *fCounters;
+		
+		real64 fStartTime;
+		
+	public:
+	
+		dng_perf_tile_scope (dng_perf_counters *counters,
+							 uint64 tileBytes = 0);
+		
+		~dng_perf_tile_scope ();
+		
+		/// Add compressed bytes that are only known after the tile has been
+		/// processed.
+		
+		void AddTileBytes (uint64 tileBytes);
+		
+	};
+
 /*****************************************************************************/
 
 /// \brief The main class for communication between the application and the 
@@ -113,6 +194,11 @@ class dng_host: private dng_uncopyable
 		uint32 fFastSaveToDNGSize;
 
 		bool fPreserveStage2;
+		
+		// Burst Photo modified (added): counters of the tiles read and
+		// written with this host, NULL if they are not counted.
+		
+		dng_perf_counters *fPerfCounters;
 	
 	public:
 	
@@ -454,6 +540,23 @@ class dng_host: private dng_uncopyable
 			{
 			fPreserveStage2 = flag;
 			}
+			
+		/// Burst Photo modified (added): Getter for the counters of the tiles
+		/// read and written with this host. NULL if they are not counted.
+		
+		dng_perf_counters * PerfCounters () const
+			{
+			return fPerfCounters;
+			}
+			
+		/// Burst Photo modified (added): Setter for the counters of the tiles
+		/// read and written with this host. The counters are not owned by the
+		/// host.
+		
+		void SetPerfCounters (dng_perf_counters *counters)
+			{
+			fPerfCounters = counters;
+			}
 		
 	};
 	
@@ -3180,6 +3180,10 @@ uint64 big_table_tag_set::DataSize ()
 /*****************************************************************************/
 
 dng_image_writer::dng_image_writer ()
+
+	:	fRawCompression		 (ccJPEG)
+	,	fRawCompressionLevel (-1)
+
 	{
 	
 	}
@@ -3250,12 +3254,244 @@ uint32 dng_image_writer::CompressedBufferSize (const dng_ifd &ifd,
 							
 /******************************************************************************/
 
+// Burst Photo modified (added): vector versions of the horizontal predictor.
+// Rows are encoded from the end, so the samples a vector subtracts have not
+// been replaced by their differences yet. This works for any channel count.
+
+#if qDNGHasSSE2
+
+template <uint32 kSampleSize>
+DNG_ALWAYS_INLINE __m128i SubSamplesSSE2 (__m128i a, __m128i b)
+	{
+	
+	return kSampleSize == 1 ? _mm_sub_epi8  (a, b) :
+		   kSampleSize == 2 ? _mm_sub_epi16 (a, b) :
+							  _mm_sub_epi32 (a, b);
+	
+	}
+
+/******************************************************************************/
+
+template <typename T>
+static void EncodeDeltaRowSSE2 (T *dPtr,
+								uint32 count,
+								uint32 channels)
+	{
+	
+	const uint32 kVectorSamples = 16 / (uint32) sizeof (T);
+	
+	uint32 index = count;
+	
+	while (index >= channels + kVectorSamples)
+		{
+		
+		index -= kVectorSamples;
+		
+		__m128i x = _mm_loadu_si128 ((const __m128i *) (dPtr + index));
+		__m128i p = _mm_loadu_si128 ((const __m128i *) (dPtr + index - channels));
+		
+		_mm_storeu_si128 ((__m128i *) (dPtr + index),
+						  SubSamplesSSE2<sizeof (T)> (x, p));
+		
+		}
+		
+	while (index > channels)
+		{
+		
+		index--;
+		
+		dPtr [index] -= dPtr [index - channels];
+		
+		}
+	
+	}
+
+#endif	// qDNGHasSSE2
+
+/******************************************************************************/
+
+#if qDNGHasAVX2
+
+template <uint32 kSampleSize>
+DNG_TARGET_AVX2 inline __m256i SubSamplesAVX2 (__m256i a, __m256i b)
+	{
+	
+	return kSampleSize == 1 ? _mm256_sub_epi8  (a, b) :
+		   kSampleSize == 2 ? _mm256_sub_epi16 (a, b) :
+							  _mm256_sub_epi32 (a, b);
+	
+	}
+
+/******************************************************************************/
+
+template <typename T>
+DNG_TARGET_AVX2 static void EncodeDeltaRowAVX2 (T *dPtr,
+												uint32 count,
+												uint32 channels)
+	{
+	
+	const uint32 kVectorSamples = 32 / (uint32) sizeof (T);
+	
+	uint32 index = count;
+	
+	while (index >= channels + kVectorSamples)
+		{
+		
+		index -= kVectorSamples;
+		
+		__m256i x = _mm256_loadu_si256 ((const __m256i *) (dPtr + index));
+		__m256i p = _mm256_loadu_si256 ((const __m256i *) (dPtr + index - channels));
+		
+		_mm256_storeu_si256 ((__m256i *) (dPtr + index),
+							 SubSamplesAVX2<sizeof (T)> (x, p));
+		
+		}
+		
+	while (index > channels)
+		{
+		
+		index--;
+		
+		dPtr [index] -= dPtr [index - channels];
+		
+		}
+	
+	}
+
+#endif	// qDNGHasAVX2
+
+/******************************************************************************/
+
+#if qDNGHasNEON
+
+template <uint32 kSampleSize>
+DNG_ALWAYS_INLINE uint8x16_t SubSamplesNEON (uint8x16_t a, uint8x16_t b)
+	{
+	
+	return kSampleSize == 1 ? vsubq_u8 (a, b) :
+		   kSampleSize == 2 ? vreinterpretq_u8_u16 (vsubq_u16 (vreinterpretq_u16_u8 (a),
+															   vreinterpretq_u16_u8 (b))) :
+							  vreinterpretq_u8_u32 (vsubq_u32 (vreinterpretq_u32_u8 (a),
+															   vreinterpretq_u32_u8 (b)));
+	
+	}
+
+/******************************************************************************/
+
+template <typename T>
+static void EncodeDeltaRowNEON (T *dPtr,
+								uint32 count,
+								uint32 channels)
+	{
+	
+	const uint32 kVectorSamples = 16 / (uint32) sizeof (T);
+	
+	uint32 index = count;
+	
+	while (index >= channels + kVectorSamples)
+		{
+		
+		index -= kVectorSamples;
+		
+		uint8x16_t x = vld1q_u8 ((const uint8 *) (dPtr + index));
+		uint8x16_t p = vld1q_u8 ((const uint8 *) (dPtr + index - channels));
+		
+		vst1q_u8 ((uint8 *) (dPtr + index),
+				  SubSamplesNEON<sizeof (T)> (x, p));
+		
+		}
+		
+	while (index > channels)
+		{
+		
+		index--;
+		
+		dPtr [index] -= dPtr [index - channels];
+		
+		}
+	
+	}
+
+#endif	// qDNGHasNEON
+
+/******************************************************************************/
+
+// Encodes the rows with the best vector version the CPU supports. Returns false
+// if there is none, the caller encodes the rows then.
+
+template <typename T>
+static bool EncodeDeltaSIMD (T *dPtr,
+							 uint32 rows,
+							 uint32 cols,
+							 uint32 channels)
+	{
+	
+	void (*encodeRow) (T *, uint32, uint32) = NULL;
+	
+	#if qDNGHasAVX2
+	
+	if (gDNGMaxSIMD >= AVX2)
+		{
+		encodeRow = EncodeDeltaRowAVX2<T>;
+		}
+		
+	else
+	
+	#endif
+	
+	#if qDNGHasSSE2
+	
+	if (gDNGMaxSIMD >= SSE2)
+		{
+		encodeRow = EncodeDeltaRowSSE2<T>;
+		}
+	
+	#endif
+	
+	#if qDNGHasNEON
+	
+	if (gDNGMaxSIMD >= arm64_neon)
+		{
+		encodeRow = EncodeDeltaRowNEON<T>;
+		}
+	
+	#endif
+	
+	if (!encodeRow)
+		{
+		return false;
+		}
+	
+	const uint32 dRowStep = cols * channels;
+	
+	for (uint32 row = 0; row < rows; row++)
+		{
+		
+		encodeRow (dPtr, dRowStep, channels);
+		
+		dPtr += dRowStep;
+		
+		}
+		
+	return true;
+	
+	}
+
+/******************************************************************************/
+
 static void EncodeDelta8 (uint8 *dPtr,
 						  uint32 rows,
 						  uint32 cols,
 						  uint32 channels)
 	{
 	
+	// Burst Photo modified (added): use the vector version, if there is one.
+	
+	if (EncodeDeltaSIMD (dPtr, rows, cols, channels))
+		{
+		return;
+		}
+	
 	const uint32 dRowStep = cols * channels;
 	
 	for (uint32 row = 0; row < rows; row++)
@@ -3287,6 +3523,13 @@ static void EncodeDelta16 (uint16 *dPtr,
 						   uint32 channels)
 	{
 	
+	// Burst Photo modified (added): use the vector version, if there is one.
+	
+	if (EncodeDeltaSIMD (dPtr, rows, cols, channels))
+		{
+		return;
+		}
+	
 	const uint32 dRowStep = cols * channels;
 	
 	for (uint32 row = 0; row < rows; row++)
@@ -3318,6 +3561,13 @@ static void EncodeDelta32 (uint32 *dPtr,
 						   uint32 channels)
 	{
 	
+	// Burst Photo modified (added): use the vector version, if there is one.
+	
+	if (EncodeDeltaSIMD (dPtr, rows, cols, channels))
+		{
+		return;
+		}
+	
 	const uint32 dRowStep = cols * channels;
 	
 	for (uint32 row = 0; row < rows; row++)
@@ -3346,6 +3596,13 @@ static void EncodeDelta32 (uint32 *dPtr,
 inline void EncodeDeltaBytes (uint8 *bytePtr, int32 cols, int32 channels)
 	{
 	
+	// Burst Photo modified (added): use the vector version, if there is one.
+	
+	if (EncodeDeltaSIMD (bytePtr, 1, (uint32) cols, (uint32) channels))
+		{
+		return;
+		}
+	
 	if (channels == 1)
 		{
 		
@@ -3426,6 +3683,177 @@ inline void EncodeDeltaBytes (uint8 *bytePtr, int32 cols, int32 channels)
 
 /*****************************************************************************/
 
+// Burst Photo modified (added): vector versions of the splitting of a floating
+// point row into byte planes. They return the number of samples that were
+// split, the caller splits the rest. The splitting is bound by memory
+// bandwidth, so there are no AVX2 versions.
+
+static int32 SplitBytes2SIMD (const uint8 *src,
+							  uint8 *dst0,
+							  uint8 *dst1,
+							  int32 count)
+	{
+	
+	int32 col = 0;
+	
+	#if qDNGHasSSE2
+	
+	if (gDNGMaxSIMD >= SSE2)
+		{
+		
+		const __m128i lowBytes = _mm_set1_epi16 (0x00FF);
+		
+		for (; col + 16 <= count; col += 16)
+			{
+			
+			__m128i s0 = _mm_loadu_si128 ((const __m128i *) (src     ));
+			__m128i s1 = _mm_loadu_si128 ((const __m128i *) (src + 16));
+			
+			_mm_storeu_si128 ((__m128i *) (dst0 + col),
+							  _mm_packus_epi16 (_mm_and_si128 (s0, lowBytes),
+												_mm_and_si128 (s1, lowBytes)));
+			
+			_mm_storeu_si128 ((__m128i *) (dst1 + col),
+							  _mm_packus_epi16 (_mm_srli_epi16 (s0, 8),
+												_mm_srli_epi16 (s1, 8)));
+			
+			src += 32;
+			
+			}
+		
+		}
+	
+	#elif qDNGHasNEON
+	
+	if (gDNGMaxSIMD >= arm64_neon)
+		{
+		
+		for (; col + 16 <= count; col += 16)
+			{
+			
+			uint8x16x2_t s = vld2q_u8 (src);
+			
+			vst1q_u8 (dst0 + col, s.val [0]);
+			vst1q_u8 (dst1 + col, s.val [1]);
+			
+			src += 32;
+			
+			}
+		
+		}
+	
+	#else
+	
+	(void) src;
+	(void) dst0;
+	(void) dst1;
+	(void) count;
+	
+	#endif
+	
+	return col;
+	
+	}
+
+/*****************************************************************************/
+
+static int32 SplitBytes4SIMD (const uint8 *src,
+							  uint8 *dst0,
+							  uint8 *dst1,
+							  uint8 *dst2,
+							  uint8 *dst3,
+							  int32 count)
+	{
+	
+	int32 col = 0;
+	
+	#if qDNGHasSSE2
+	
+	if (gDNGMaxSIMD >= SSE2)
+		{
+		
+		const __m128i lowBytes = _mm_set1_epi16 (0x00FF);
+		
+		for (; col + 16 <= count; col += 16)
+			{
+			
+			__m128i s0 = _mm_loadu_si128 ((const __m128i *) (src     ));
+			__m128i s1 = _mm_loadu_si128 ((const __m128i *) (src + 16));
+			__m128i s2 = _mm_loadu_si128 ((const __m128i *) (src + 32));
+			__m128i s3 = _mm_loadu_si128 ((const __m128i *) (src + 48));
+			
+			// Split into the lower and upper 16 bits first. The arithmetic
+			// shifts keep the signed saturation of the packs exact.
+			
+			__m128i lo01 = _mm_packs_epi32 (_mm_srai_epi32 (_mm_slli_epi32 (s0, 16), 16),
+											_mm_srai_epi32 (_mm_slli_epi32 (s1, 16), 16));
+			__m128i lo23 = _mm_packs_epi32 (_mm_srai_epi32 (_mm_slli_epi32 (s2, 16), 16),
+											_mm_srai_epi32 (_mm_slli_epi32 (s3, 16), 16));
+			__m128i hi01 = _mm_packs_epi32 (_mm_srai_epi32 (s0, 16),
+											_mm_srai_epi32 (s1, 16));
+			__m128i hi23 = _mm_packs_epi32 (_mm_srai_epi32 (s2, 16),
+											_mm_srai_epi32 (s3, 16));
+			
+			_mm_storeu_si128 ((__m128i *) (dst0 + col),
+							  _mm_packus_epi16 (_mm_and_si128 (lo01, lowBytes),
+												_mm_and_si128 (lo23, lowBytes)));
+			
+			_mm_storeu_si128 ((__m128i *) (dst1 + col),
+							  _mm_packus_epi16 (_mm_srli_epi16 (lo01, 8),
+												_mm_srli_epi16 (lo23, 8)));
+			
+			_mm_storeu_si128 ((__m128i *) (dst2 + col),
+							  _mm_packus_epi16 (_mm_and_si128 (hi01, lowBytes),
+												_mm_and_si128 (hi23, lowBytes)));
+			
+			_mm_storeu_si128 ((__m128i *) (dst3 + col),
+							  _mm_packus_epi16 (_mm_srli_epi16 (hi01, 8),
+												_mm_srli_epi16 (hi23, 8)));
+			
+			src += 64;
+			
+			}
+		
+		}
+	
+	#elif qDNGHasNEON
+	
+	if (gDNGMaxSIMD >= arm64_neon)
+		{
+		
+		for (; col + 16 <= count; col += 16)
+			{
+			
+			uint8x16x4_t s = vld4q_u8 (src);
+			
+			vst1q_u8 (dst0 + col, s.val [0]);
+			vst1q_u8 (dst1 + col, s.val [1]);
+			vst1q_u8 (dst2 + col, s.val [2]);
+			vst1q_u8 (dst3 + col, s.val [3]);
+			
+			src += 64;
+			
+			}
+		
+		}
+	
+	#else
+	
+	(void) src;
+	(void) dst0;
+	(void) dst1;
+	(void) dst2;
+	(void) dst3;
+	(void) count;
+	
+	#endif
+	
+	return col;
+	
+	}
+
+/*****************************************************************************/
+
 static void EncodeFPDelta (uint8 *buffer,
 						   uint8 *temp,
 						   int32 cols,
@@ -3447,8 +3875,14 @@ static void EncodeFPDelta (uint8 *buffer,
 		uint8 *dst1 = temp;
 		uint8 *dst0 = temp + rowIncrement;
 		#endif
+		
+		// Burst Photo modified: split whole vectors first.
+		
+		int32 col = SplitBytes2SIMD (src, dst0, dst1, rowIncrement);
+		
+		src += col * 2;
 				
-		for (int32 col = 0; col < rowIncrement; ++col)
+		for (; col < rowIncrement; ++col)
 			{
 			
 			dst0 [col] = src [0];
@@ -3498,8 +3932,14 @@ static void EncodeFPDelta (uint8 *buffer,
 		uint8 *dst1 = temp + rowIncrement * 2;
 		uint8 *dst0 = temp + rowIncrement * 3;
 		#endif
+		
+		// Burst Photo modified: split whole vectors first.
+		
+		int32 col = SplitBytes4SIMD (src, dst0, dst1, dst2, dst3, rowIncrement);
+		
+		src += col * 4;
 				
-		for (int32 col = 0; col < rowIncrement; ++col)
+		for (; col < rowIncrement; ++col)
 			{
 			
 			dst0 [col] = src [0];
@@ -4682,6 +5122,13 @@ void dng_image_writer::WriteTile (dng_host &host,
 								  bool usingMultipleThreads)
 	{
 	
+	// Burst Photo modified: count the tile and the time it takes to encode
+	// it, if the host has counters.
+	
+	dng_perf_tile_scope perfScope (host.PerfCounters ());
+	
+	uint64 startPosition = stream.Position ();
+	
 	// Create pixel buffer to hold uncompressed tile.
 	
 	dng_pixel_buffer buffer (tileArea, 
@@ -4693,8 +5140,16 @@ void dng_image_writer::WriteTile (dng_host &host,
 	
 	// Get the uncompressed data.
 	
+	real64 copyStartTime = host.PerfCounters () ? TickTimeInSeconds () : 0.0;
+	
 	image.Get (buffer, dng_image::edge_zero);
 	
+	if (host.PerfCounters ())
+		{
+		dng_perf_counters::AddTime (host.PerfCounters ()->fCopyNanoseconds,
+									copyStartTime);
+		}
+	
 	// Deal with sub-tile blocks.
 	
 	if (ifd.fSubTileBlockRows > 1)
@@ -4809,6 +5264,8 @@ void dng_image_writer::WriteTile (dng_host &host,
 			   compressedBuffer,
 			   usingMultipleThreads);
 			   
+	perfScope.AddTileBytes (stream.Position () - startPosition);
+			   
 	}
 
 /*****************************************************************************/
@@ -5019,6 +5476,11 @@ void dng_write_tiles_task::ProcessTask
 					
 	dng_host host (&fHost.Allocator (),
 				   sniffer);
+				   
+	// Burst Photo modified: tiles are counted with the counters of the main
+	// host.
+	
+	host.SetPerfCounters (fHost.PerfCounters ());
 								
 	fImageWriter.WriteTile (host,
 							fIFD,
@@ -6675,7 +7137,15 @@ void dng_image_writer::WriteDNGWithMetadata (dng_host &host,
 	// Figure out the compression to use.  Most of the time this is lossless
 	// JPEG.
 	
-	uint32 compression = uncompressed ? ccUncompressed : ccJPEG;
+	// Burst Photo modified: the compression can be selected with
+	// SetRawCompression.
+	
+	if (fRawCompression == ccUncompressed)
+		{
+		uncompressed = true;
+		}
+	
+	uint32 compression = uncompressed ? (uint32) ccUncompressed : fRawCompression;
 		
 	// Was the the original file lossy JPEG compressed?
 	
@@ -6683,7 +7153,7 @@ void dng_image_writer::WriteDNGWithMetadata (dng_host &host,
 	
 	// If so, can we save it using the requested compression and DNG version?
 	
-	if (uncompressed || maxBackwardVersion < dngVersion_1_4_0_0)
+	if (uncompressed || compression != ccJPEG || maxBackwardVersion < dngVersion_1_4_0_0)
 		{
 		
 		if (rawJPEGImage || negative.RawJPEGImageDigest ().IsValid ())
@@ -6918,7 +7388,8 @@ void dng_image_writer::WriteDNGWithMetadata (dng_host &host,
 		dngBackwardVersion = Max_uint32 (dngBackwardVersion, dngVersion_1_3_0_0);
 		}
 		
-	if (rawJPEGImage || isFloatingPoint || hasTransparencyMask || isCompressed32BitInteger)
+	if (rawJPEGImage || isFloatingPoint || hasTransparencyMask || isCompressed32BitInteger ||
+		compression == ccDeflate)
 		{
 		dngBackwardVersion = Max_uint32 (dngBackwardVersion, dngVersion_1_4_0_0);
 		}
@@ -7079,6 +7550,14 @@ void dng_image_writer::WriteDNGWithMetadata (dng_host &host,
 			
 	info.fCompression = compression;
 	
+	// Burst Photo modified (added): zlib level selected with
+	// SetRawCompression.
+	
+	if (compression == ccDeflate)
+		{
+		info.fCompressionQuality = fRawCompressionLevel;
+		}
+	
 	if (isFloatingPoint && compression == ccDeflate)
 		{
 		
@@ -7101,7 +7580,10 @@ void dng_image_writer::WriteDNGWithMetadata (dng_host &host,
 			
 		} 
 		
-	if (isCompressed32BitInteger)
+	// Burst Photo modified: integer images that are deflate compressed on
+	// request use the same predictors as compressed 32-bit integer images.
+	
+	if (isCompressed32BitInteger || (compression == ccDeflate && !isFloatingPoint))
 		{
 		
 		info.fPredictor = cpHorizontalDifference;
@@ -1202,6 +1202,13 @@ class dng_image_writer
 			kImageBufferSize = 128 * 1024
 			
 			};
+			
+		// Burst Photo modified (added): compression of the raw image written
+		// by WriteDNG, see SetRawCompression.
+		
+		uint32 fRawCompression;
+		
+		int32 fRawCompressionLevel;
 	
 	public:
 	
@@ -1209,6 +1216,19 @@ class dng_image_writer
 		
 		virtual ~dng_image_writer ();
 		
+		/// Burst Photo modified (added): Select the compression of the raw
+		/// image written by WriteDNG. The default is lossless JPEG.
+		/// \param compression ccJPEG, ccDeflate or ccUncompressed.
+		/// \param level zlib compression level (1 to 9) for ccDeflate, or -1 for
+		/// the zlib default.
+		
+		void SetRawCompression (uint32 compression,
+								int32 level = -1)
+			{
+			fRawCompression		 = compression;
+			fRawCompressionLevel = level;
+			}
+		
 		virtual void EncodeJPEGPreview (dng_host &host,
 										const dng_image &image,
 										dng_jpeg_preview &preview,
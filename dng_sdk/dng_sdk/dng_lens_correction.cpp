@@ -2767,13 +2767,10 @@ void dng_opcode_FixVignetteRadial::Prepare (dng_negative &negative,
 													 padSIMDBytes);
 
 		// Support repeated Prepare() calls by ensuring all buffers are reset.
+		// Burst Photo modified: the array is sized by the thread count instead
+		// of kMaxMPThreads, resizing it releases the previous buffers.
 
-		for (uint32 threadIndex = 0; threadIndex < kMaxMPThreads; threadIndex++)
-			{
-				
-			fMaskBuffers [threadIndex] . Reset ();
-				
-			}
+		fMaskBuffers.Reset (threadCount);
 
 		for (uint32 threadIndex = 0; threadIndex < threadCount; threadIndex++)
 			{
@@ -25,7 +25,8 @@ void DecodeLosslessJPEG<Scalar> (dng_stream &stream,
 								 uint32 minDecodedSize,
 								 uint32 maxDecodedSize,
 								 bool bug16,
-								 uint64 endOfData);
+								 uint64 endOfData,
+								 dng_host *host);
 
 template
 void EncodeLosslessJPEG<Scalar> (const uint16 *srcData,
@@ -47,7 +47,8 @@ void DecodeLosslessJPEG (dng_stream &stream,
 						 uint32 minDecodedSize,
 						 uint32 maxDecodedSize,
 						 bool bug16,
-						 uint64 endOfData);
+						 uint64 endOfData,
+						 dng_host *host);		// Burst Photo modified (added)
 
 template<SIMDType simd>
 void EncodeLosslessJPEG (const uint16 *srcData,
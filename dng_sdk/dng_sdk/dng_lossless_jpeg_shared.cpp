@@ -41,14 +41,19 @@
 
 #include "dng_lossless_jpeg.h"
 
+#include "dng_abort_sniffer.h"
+#include "dng_area_task.h"
 #include "dng_assertions.h"
 #include "dng_exceptions.h"
+#include "dng_host.h"
 #include "dng_memory.h"
+#include "dng_rect.h"
 #include "dng_simd_type.h"
 #include "dng_stream.h"
 #include "dng_tag_codes.h"
 
 #include <algorithm>
+#include <atomic>
 
 /*****************************************************************************/
 
@@ -111,6 +116,49 @@ struct HuffmanTable
 
 /*****************************************************************************/
 
+// Burst Photo modified (added): the decoder looks up the next kHuffLookupBits
+// bits of the bit stream in a table per Huffman table. An entry with the
+// kHuffLookupComplete flag holds the number of bits of the code and its
+// difference bits (low byte) and the difference value (high 16 bits). Other
+// non-zero entries hold the number of bits of the code and the symbol (the
+// number of difference bits that follow). Codes longer than kHuffLookupBits
+// have zero entries and are decoded by HuffDecode.
+
+const int32 kHuffLookupBits = 12;
+
+const int32 kHuffLookupSize = 1 << kHuffLookupBits;
+
+const int32 kHuffLookupComplete = 0x100;
+
+/*****************************************************************************/
+
+// Burst Photo modified (added): images with at least this decoded size are
+// decoded on several threads, if the host has more than one thread. See
+// dng_lossless_decoder::FinishReadInParts.
+
+const uint32 kMinPartsDecodedSize = 2 * 1024 * 1024;
+
+// Minimum number of bytes of each part of a scan without restart markers.
+
+const uint32 kMinSpeculativePartSize = 64 * 1024;
+
+// Number of bit positions recorded at the start of each part of a scan
+// without restart markers, to find the difference at which its decoder
+// agrees with the decoder of the part before it.
+
+const uint32 kSyncPositions = 1024;
+
+// Burst Photo modified (added): the encoder counts the differences of every
+// kFreqCountRowStep-th row to build its Huffman tables, if the image has at
+// least kMinSampledFreqCount samples. The step is odd and prime, so that all
+// rows of the repeat patterns of color filter arrays are counted.
+
+const uint32 kFreqCountRowStep = 7;
+
+const uint32 kMinSampledFreqCount = 64 * 1024;
+
+/*****************************************************************************/
+
 // Computes the derived fields in the Huffman table structure.
  
 static void FixHuffTbl (HuffmanTable *htbl)
@@ -368,10 +416,24 @@ typedef ComponentType *MCU;			// MCU - array of samples
 
 /*****************************************************************************/
 
+template <SIMDType simd>
+class dng_lossless_restart_task;
+
+template <SIMDType simd>
+class dng_lossless_speculative_task;
+
+/*****************************************************************************/
+
 template <SIMDType simd>
 class dng_lossless_decoder: private dng_uncopyable
 	{
 	
+	// Burst Photo modified (added): the tasks decode parts of the scan with
+	// decoders of their own.
+	
+	friend class dng_lossless_restart_task<simd>;
+	friend class dng_lossless_speculative_task<simd>;
+	
 	private:
 	
 		dng_stream *fStream;		// Input data.
@@ -396,6 +458,27 @@ class dng_lossless_decoder: private dng_uncopyable
 		
 		uint64 getBuffer;			// current bit-extraction buffer
 		int32 bitsLeft;				// # of unused bits in it
+		
+		// Burst Photo modified (added): contents of the stream if it is
+		// entirely in memory, so that FillBitBuffer can load several bytes
+		// at once.
+		
+		const uint8 *fStreamData;
+		uint64 fStreamLength;
+		
+		// Burst Photo modified (added): lookup table of each Huffman table.
+		
+		dng_memory_data fLookupBuffer [4];
+		
+		// Burst Photo modified (added): set when the bit buffer had to be
+		// filled with zero bits at a marker.
+		
+		bool fHitMarker;
+		
+		// Burst Photo modified (added): component of the next difference
+		// decoded by DecodeDifferences and NextDifference.
+		
+		int32 fComponent;
 				
 		#if qSupportHasselblad_3FR
 		bool fHasselblad3FR;
@@ -413,6 +496,10 @@ class dng_lossless_decoder: private dng_uncopyable
 
 		void FinishRead ();
 		
+		bool FinishReadInParts (dng_host &host,
+								uint64 startOfData,
+								uint64 endOfData);
+		
 		#if qSupportHasselblad_3FR
 	
 		bool IsHasselblad3FR ()
@@ -462,6 +549,8 @@ class dng_lossless_decoder: private dng_uncopyable
 
 		void HuffDecoderInit ();
 
+		void BuildLookupTable (int32 tableIndex);
+
 		void ProcessRestart ();
 
 		int32 QuickPredict (int32 col,
@@ -483,6 +572,9 @@ class dng_lossless_decoder: private dng_uncopyable
 
 		void HuffExtend (int32 &x, int32 s);
 
+		int32 DecodeDifference (const int32 *lookup,
+								HuffmanTable *htbl);
+
 		void PmPutRow (MCU *buf,
 					   int32 numComp,
 					   int32 numCol,
@@ -490,8 +582,34 @@ class dng_lossless_decoder: private dng_uncopyable
 
 		void DecodeFirstRow (MCU *curRowBuf);
 
+		void FindTables (HuffmanTable *ht [4],
+						 const int32 *lookup [4]);
+
+		void DecodeRows (int32 numROW);
+
 		void DecodeImage ();
 		
+		bool CanDecodeInParts () const;
+		
+		void SeekScan (uint64 offset);
+		
+		uint64 ScanPosition () const;
+		
+		void DecodeIntervals (uint64 offset,
+							  uint32 interval,
+							  uint32 rows);
+		
+		uint32 DecodeDifferences (uint16 *buffer,
+								  uint32 count,
+								  uint64 endPosition,
+								  uint64 *positions,
+								  uint32 positionCount);
+		
+		uint16 NextDifference ();
+		
+		void PutDifferences (const uint16 * const *runData,
+							 const uint32 *runCount);
+		
 	};
 
 /*****************************************************************************/
@@ -515,6 +633,10 @@ dng_lossless_decoder<simd>::dng_lossless_decoder (dng_stream *stream,
 	,	mcuROW2		   (NULL)
 	,	getBuffer	   (0)
 	,	bitsLeft	   (0)
+	,	fStreamData	   ((const uint8 *) stream->Data ())
+	,	fStreamLength  (fStreamData ? stream->Length () : 0)
+	,	fHitMarker	   (false)
+	,	fComponent	   (0)
 	
 	#if qSupportHasselblad_3FR
 	,	fHasselblad3FR (false)
@@ -1316,6 +1438,8 @@ void dng_lossless_decoder<simd>::HuffDecoderInit ()
 		// big deal
 
 		FixHuffTbl (info.dcHuffTblPtrs [compptr->dcTblNo]);
+		
+		BuildLookupTable (compptr->dcTblNo);
 
 		}
 
@@ -1329,6 +1453,80 @@ void dng_lossless_decoder<simd>::HuffDecoderInit ()
 
 /*****************************************************************************/
 
+// Burst Photo modified (added): builds the lookup table of a Huffman table,
+// see kHuffLookupBits. Must be called after FixHuffTbl.
+
+template <SIMDType simd>
+void dng_lossless_decoder<simd>::BuildLookupTable (int32 tableIndex)
+	{
+	
+	const HuffmanTable *htbl = info.dcHuffTblPtrs [tableIndex];
+	
+	fLookupBuffer [tableIndex].Allocate (kHuffLookupSize, sizeof (int32));
+	
+	int32 *lookup = fLookupBuffer [tableIndex].Buffer_int32 ();
+	
+	memset (lookup, 0, kHuffLookupSize * sizeof (int32));
+	
+	for (int32 symbol = 0; symbol < 256; symbol++)
+		{
+		
+		int32 size = htbl->ehufsi [symbol];
+		
+		if (size <= 0 || size > kHuffLookupBits)
+			{
+			continue;
+			}
+			
+		// Each code fills the entries of all bit patterns that start with it.
+		// Codes of invalid tables that do not fit are left to HuffDecode.
+			
+		int32 first = htbl->ehufco [symbol] << (kHuffLookupBits - size);
+		int32 count = 1 << (kHuffLookupBits - size);
+		
+		if (first + count > kHuffLookupSize)
+			{
+			continue;
+			}
+		
+		for (int32 i = 0; i < count; i++)
+			{
+			
+			int32 entry;
+			
+			if (symbol == 0)
+				{
+				entry = kHuffLookupComplete | size;
+				}
+				
+			else if (symbol < 16 && size + symbol <= kHuffLookupBits)
+				{
+				
+				// The difference bits follow the code within the looked up bits.
+				
+				int32 d = (i >> (kHuffLookupBits - size - symbol)) & ((1 << symbol) - 1);
+				
+				HuffExtend (d, symbol);
+				
+				entry = (int32) ((uint32) d << 16) | kHuffLookupComplete | (size + symbol);
+				
+				}
+				
+			else
+				{
+				entry = (symbol << 16) | size;
+				}
+				
+			lookup [first + i] = entry;
+			
+			}
+			
+		}
+	
+	}
+
+/*****************************************************************************/
+
 /*
  *--------------------------------------------------------------
  *
@@ -1351,7 +1549,10 @@ void dng_lossless_decoder<simd>::ProcessRestart ()
 	
 	// Throw away and unused odd bits in the bit buffer.
 	
-	fStream->SetReadPosition (fStream->Position () - bitsLeft / 8);
+	// Burst Photo modified: the read position is not moved back by the whole
+	// bytes left in the bit buffer. FillBitBuffer never reads past a marker,
+	// so the restart marker is always ahead of the read position, and the
+	// bit buffer can contain zero bytes that were not read from the stream.
 	
 	bitsLeft  = 0;
 	getBuffer = 0;
@@ -1557,6 +1758,54 @@ DNG_ALWAYS_INLINE void dng_lossless_decoder<simd>::FillBitBuffer (int32 nbits)
 	
 	#endif
 	
+	// Burst Photo modified (added): if the stream is in memory, load as many
+	// whole bytes as fit into the bit buffer at once, as long as none of them
+	// is 0xFF. Stuffed bytes and markers are handled by the loop below.
+	
+	if (fStreamData && bitsLeft <= 56)
+		{
+		
+		uint64 position = fStream->Position ();
+		
+		if (position + 8 <= fStreamLength)
+			{
+			
+			const uint8 *p = fStreamData + position;
+			
+			uint64 bytes = ((uint64) p [0] << 56) |
+						   ((uint64) p [1] << 48) |
+						   ((uint64) p [2] << 40) |
+						   ((uint64) p [3] << 32) |
+						   ((uint64) p [4] << 24) |
+						   ((uint64) p [5] << 16) |
+						   ((uint64) p [6] <<  8) |
+						   ((uint64) p [7]		 );
+			
+			uint32 count = (uint32) (63 - bitsLeft) >> 3;
+			
+			uint64 next = bytes >> (64 - 8 * count);
+			
+			// A byte of ~next is zero where next has a 0xFF byte.
+			
+			uint64 inverted = ~next;
+			
+			if (((inverted - 0x0101010101010101ULL) & ~inverted & 0x8080808080808080ULL) == 0)
+				{
+				
+				getBuffer = (getBuffer << (8 * count)) | next;
+				
+				bitsLeft += 8 * count;
+				
+				fStream->SetReadPosition (position + count);
+				
+				return;
+				
+				}
+			
+			}
+		
+		}
+	
 	while (bitsLeft < kMinGetBits)
 		{
 		
@@ -1591,6 +1840,11 @@ DNG_ALWAYS_INLINE void dng_lossless_decoder<simd>::FillBitBuffer (int32 nbits)
 
 				c = 0;
 				
+				// Burst Photo modified (added): remember that the end of the
+				// segment has been reached.
+				
+				fHitMarker = true;
+				
 				}
 				
 			}
@@ -1807,6 +2061,69 @@ DNG_ALWAYS_INLINE void dng_lossless_decoder<simd>::HuffExtend (int32 &x, int32 s
 
 /*****************************************************************************/
 
+// Burst Photo modified (added): decodes the next Huffman code and its
+// difference bits (Section F.2.2.1), with a single table lookup for most
+// codes.
+
+template <SIMDType simd>
+DNG_ALWAYS_INLINE int32 dng_lossless_decoder<simd>::DecodeDifference (const int32 *lookup,
+																	  HuffmanTable *htbl)
+	{
+	
+	if (bitsLeft < kHuffLookupBits)
+		FillBitBuffer (kHuffLookupBits);
+		
+	int32 entry = lookup [(getBuffer >> (bitsLeft - kHuffLookupBits)) & (kHuffLookupSize - 1)];
+	
+	if (entry & kHuffLookupComplete)
+		{
+		
+		bitsLeft -= entry & 0xFF;
+		
+		return entry >> 16;
+		
+		}
+		
+	int32 s;
+	
+	if (entry)
+		{
+		
+		bitsLeft -= entry & 0xFF;
+		
+		s = entry >> 16;
+		
+		}
+		
+	else
+		{
+		s = HuffDecode (htbl);
+		}
+		
+	int32 d = 0;
+	
+	if (s)
+		{
+		
+		if (s == 16 && !fBug16)
+			{
+			d = -32768;
+			}
+		
+		else
+			{
+			d = get_bits (s);
+			HuffExtend (d, s);
+			}
+
+		}
+		
+	return d;
+	
+	}
+
+/*****************************************************************************/
+
 // Called from DecodeImage () to write one row.
 
 template <SIMDType simd>
@@ -1865,25 +2182,8 @@ void dng_lossless_decoder<simd>::DecodeFirstRow (MCU *curRowBuf)
 
 		// Section F.2.2.1: decode the difference
 
-		int32 d = 0;
-	
-		int32 s = HuffDecode (dctbl);
-		
-		if (s)
-			{
-			
-			if (s == 16 && !fBug16)
-				{
-				d = -32768;
-				}
-			
-			else
-				{
-				d = get_bits (s);
-				HuffExtend (d, s);
-				}
-
-			}
+		int32 d = DecodeDifference (fLookupBuffer [compptr->dcTblNo].Buffer_int32 (),
+									dctbl);
 
 		// Add the predictor to the difference.
 
@@ -1912,25 +2212,8 @@ void dng_lossless_decoder<simd>::DecodeFirstRow (MCU *curRowBuf)
 
 			// Section F.2.2.1: decode the difference
 
-			int32 d = 0;
-		
-			int32 s = HuffDecode (dctbl);
-			
-			if (s)
-				{
-
-				if (s == 16 && !fBug16)
-					{
-					d = -32768;
-					}
-				
-				else
-					{
-					d = get_bits (s);
-					HuffExtend (d, s);
-					}
-
-				}
+			int32 d = DecodeDifference (fLookupBuffer [compptr->dcTblNo].Buffer_int32 (),
+										dctbl);
 				
 			// Add the predictor to the difference.
 
@@ -1951,41 +2234,19 @@ void dng_lossless_decoder<simd>::DecodeFirstRow (MCU *curRowBuf)
 
 /*****************************************************************************/
 
-/*
- *--------------------------------------------------------------
- *
- * DecodeImage --
- *
- *		Decode the input stream. This includes modifying
- *		the component value so the real value, not the
- *		difference is returned.
- *
- * Results:
- *		None.
- *
- * Side effects:
- *		Bitstream is parsed.
- *
- *--------------------------------------------------------------
- */
- 
+// Burst Photo modified (added): finds the Huffman table and its lookup table
+// for each component in the scan.
+
 template <SIMDType simd>
-void dng_lossless_decoder<simd>::DecodeImage ()
+void dng_lossless_decoder<simd>::FindTables (HuffmanTable *ht [4],
+											 const int32 *lookup [4])
 	{
 	
-	#define swap(type,a,b) {type c; c=(a); (a)=(b); (b)=c;}
-
-	int32 numCOL	  = info.imageWidth;
-	int32 numROW	  = info.imageHeight;
-	int32 compsInScan = info.compsInScan;
-	
-	// Precompute the decoding table for each table.
+	memset (ht, 0, 4 * sizeof (ht [0]));
 	
-	HuffmanTable *ht [4];
-
-	memset (ht, 0, sizeof (ht));
+	memset (lookup, 0, 4 * sizeof (lookup [0]));
 	
-	for (int32 curComp = 0; curComp < compsInScan; curComp++)
+	for (int32 curComp = 0; curComp < info.compsInScan; curComp++)
 		{
 		
 		int32 ci = info.MCUmembership [curComp];
@@ -1993,26 +2254,216 @@ void dng_lossless_decoder<simd>::DecodeImage ()
 		JpegComponentInfo *compptr = info.curCompInfo [ci];
 		
 		ht [curComp] = info.dcHuffTblPtrs [compptr->dcTblNo];
+		
+		lookup [curComp] = fLookupBuffer [compptr->dcTblNo].Buffer_int32 ();
 
 		}
+	
+	}
+
+/*****************************************************************************/
+
+// Burst Photo modified (added): decodes numROW rows, starting with the first
+// row of the scan or of a restart interval. Split from DecodeImage, so that
+// the restart intervals of a scan can be decoded by several decoders.
+
+template <SIMDType simd>
+void dng_lossless_decoder<simd>::DecodeRows (int32 numROW)
+	{
+	
+	#define swap(type,a,b) {type c; c=(a); (a)=(b); (b)=c;}
+
+	int32 numCOL	  = info.imageWidth;
+	int32 compsInScan = info.compsInScan;
+	
+	HuffmanTable *ht [4];
+	
+	const int32 *lookup [4];
+	
+	FindTables (ht, lookup);
 		
 	MCU *prevRowBuf = mcuROW1;
 	MCU *curRowBuf	= mcuROW2;
 	
-	#if qSupportCanon_sRAW
-		
-	// Canon sRAW support
+	// Decode the first row of image. Output the row and
+	// turn this row into a previous row for later predictor
+	// calculation.
+
+	DecodeFirstRow (mcuROW1);
 	
-	if (info.compInfo [0].hSampFactor == 2 &&
-		info.compInfo [0].vSampFactor == 1)
-		{
+	PmPutRow (mcuROW1, compsInScan, numCOL, 0);
 	
-		for (int32 row = 0; row < numROW; row++)
+	// Process each row.
+
+	for (int32 row = 1; row < numROW; row++)
+		{
+
+		// Account for restart interval, process restart marker if needed.
+
+		if (info.restartInRows)
 			{
 			
-			// Initialize predictors.
+			if (info.restartRowsToGo == 0)
+				{
+				
+				ProcessRestart ();
 			
-			int32 p0;
+				// Reset predictors at restart.
+				
+				DecodeFirstRow (curRowBuf);
+				
+				PmPutRow (curRowBuf, compsInScan, numCOL, row);
+				
+				swap (MCU *, prevRowBuf, curRowBuf);
+				
+				continue;
+				
+				}
+				
+			info.restartRowsToGo--;
+		   
+			}
+			
+		// The upper neighbors are predictors for the first column.
+
+		for (int32 curComp = 0; curComp < compsInScan; curComp++)
+			{
+			
+			// Section F.2.2.1: decode the difference
+
+			int32 d = DecodeDifference (lookup [curComp], ht [curComp]);
+				
+			// First column of row above is predictor for first column.
+
+			curRowBuf [0] [curComp] = (ComponentType) (d + prevRowBuf [0] [curComp]);
+			
+			}
+
+		// For the rest of the column on this row, predictor
+		// calculations are based on PSV. 
+
+		if (compsInScan == 2 && info.Ss == 1 && numCOL > 1)
+			{
+			
+			// This is the combination used by both the Canon and Kodak raw formats. 
+			// Unrolling the general case logic results in a significant speed increase.
+			
+			uint16 *dPtr = &curRowBuf [1] [0];
+			
+			int32 prev0 = dPtr [-2];
+			int32 prev1 = dPtr [-1];
+			
+			for (int32 col = 1; col < numCOL; col++)
+				{
+				
+				prev0 += DecodeDifference (lookup [0], ht [0]);
+					
+				prev1 += DecodeDifference (lookup [1], ht [1]);
+				
+				dPtr [0] = (uint16) prev0;
+				dPtr [1] = (uint16) prev1;
+				
+				dPtr += 2;
+				
+				}
+				
+			}
+			
+		else
+			{
+			
+			for (int32 col = 1; col < numCOL; col++)
+				{
+				
+				for (int32 curComp = 0; curComp < compsInScan; curComp++)
+					{
+					
+					// Section F.2.2.1: decode the difference
+
+					int32 d = DecodeDifference (lookup [curComp], ht [curComp]);
+						
+					// Predict the pixel value.
+					
+					int32 predictor = QuickPredict (col,
+													curComp,
+													curRowBuf,
+													prevRowBuf);
+												  
+					// Save the difference.
+
+					curRowBuf [col] [curComp] = (ComponentType) (d + predictor);
+					
+					}
+					
+				}
+
+			}
+
+		PmPutRow (curRowBuf, compsInScan, numCOL, row);
+		
+		swap (MCU *, prevRowBuf, curRowBuf);
+		
+		}
+		
+	#undef swap
+	
+	}
+
+/*****************************************************************************/
+
+/*
+ *--------------------------------------------------------------
+ *
+ * DecodeImage --
+ *
+ *		Decode the input stream. This includes modifying
+ *		the component value so the real value, not the
+ *		difference is returned.
+ *
+ * Results:
+ *		None.
+ *
+ * Side effects:
+ *		Bitstream is parsed.
+ *
+ *--------------------------------------------------------------
+ */
+ 
+template <SIMDType simd>
+void dng_lossless_decoder<simd>::DecodeImage ()
+	{
+	
+	#define swap(type,a,b) {type c; c=(a); (a)=(b); (b)=c;}
+
+	int32 numCOL	  = info.imageWidth;
+	int32 numROW	  = info.imageHeight;
+	int32 compsInScan = info.compsInScan;
+	
+	// Precompute the decoding table for each table.
+	
+	HuffmanTable *ht [4];
+	
+	const int32 *lookup [4];
+	
+	FindTables (ht, lookup);
+		
+	MCU *prevRowBuf = mcuROW1;
+	MCU *curRowBuf	= mcuROW2;
+	
+	#if qSupportCanon_sRAW
+		
+	// Canon sRAW support
+	
+	if (info.compInfo [0].hSampFactor == 2 &&
+		info.compInfo [0].vSampFactor == 1)
+		{
+	
+		for (int32 row = 0; row < numROW; row++)
+			{
+			
+			// Initialize predictors.
+			
+			int32 p0;
 			int32 p1;
 			int32 p2;
 			
@@ -2460,233 +2911,1279 @@ void dng_lossless_decoder<simd>::DecodeImage ()
 	
 	#endif
 	
-	// Decode the first row of image. Output the row and
-	// turn this row into a previous row for later predictor
-	// calculation.
+	// Burst Photo modified: the rows are decoded by DecodeRows.
+	
+	DecodeRows (numROW);
+	
+	#undef swap
+	
+	}
 
-	DecodeFirstRow (mcuROW1);
+/*****************************************************************************/
+
+template <SIMDType simd>
+void dng_lossless_decoder<simd>::StartRead (uint32 &imageWidth,
+											uint32 &imageHeight,
+											uint32 &imageChannels)
+	{ 
 	
-	PmPutRow (mcuROW1, compsInScan, numCOL, 0);
+	ReadFileHeader	  ();
+	ReadScanHeader	  ();
+	DecoderStructInit ();
+	HuffDecoderInit	  ();
 	
-	// Process each row.
+	imageWidth	  = info.imageWidth;
+	imageHeight	  = info.imageHeight;
+	imageChannels = info.compsInScan;
+	
+	}
 
-	for (int32 row = 1; row < numROW; row++)
-		{
+/*****************************************************************************/
 
-		// Account for restart interval, process restart marker if needed.
+template <SIMDType simd>
+void dng_lossless_decoder<simd>::FinishRead ()
+	{
+	
+	DecodeImage ();
+		
+	}
 
-		if (info.restartInRows)
-			{
-			
-			if (info.restartRowsToGo == 0)
-				{
-				
-				ProcessRestart ();
-			
-				// Reset predictors at restart.
-				
-				DecodeFirstRow (curRowBuf);
-				
-				PmPutRow (curRowBuf, compsInScan, numCOL, row);
-				
-				swap (MCU *, prevRowBuf, curRowBuf);
-				
-				continue;
-				
-				}
-				
-			info.restartRowsToGo--;
-		   
-			}
-			
-		// The upper neighbors are predictors for the first column.
+/*****************************************************************************/
 
-		for (int32 curComp = 0; curComp < compsInScan; curComp++)
-			{
-			
-			// Section F.2.2.1: decode the difference
+// Burst Photo modified (added): returns true if the rows of the scan are
+// decoded by DecodeRows, i.e. for all scans except Canon sRAW and
+// Hasselblad 3FR scans.
 
-			int32 d = 0;
+template <SIMDType simd>
+bool dng_lossless_decoder<simd>::CanDecodeInParts () const
+	{
+	
+	if (info.compInfo [0].hSampFactor != 1 ||
+		info.compInfo [0].vSampFactor != 1)
+		{
+		return false;
+		}
 		
-			int32 s = HuffDecode (ht [curComp]);
-			
-			if (s)
-				{
+	return info.Ss >= 0 && info.Ss <= 7;
+	
+	}
 
-				if (s == 16 && !fBug16)
-					{
-					d = -32768;
-					}
-				
-				else
-					{
-					d = get_bits (s);
-					HuffExtend (d, s);
-					}
+/*****************************************************************************/
 
-				}
-				
-			// First column of row above is predictor for first column.
+// Burst Photo modified (added): continues decoding the scan at a byte
+// offset, with an empty bit buffer.
 
-			curRowBuf [0] [curComp] = (ComponentType) (d + prevRowBuf [0] [curComp]);
-			
-			}
+template <SIMDType simd>
+void dng_lossless_decoder<simd>::SeekScan (uint64 offset)
+	{
+	
+	fStream->SetReadPosition (offset);
+	
+	getBuffer  = 0;
+	bitsLeft   = 0;
+	fHitMarker = false;
+	
+	}
 
-		// For the rest of the column on this row, predictor
-		// calculations are based on PSV. 
+/*****************************************************************************/
 
-		if (compsInScan == 2 && info.Ss == 1 && numCOL > 1)
-			{
-			
-			// This is the combination used by both the Canon and Kodak raw formats. 
-			// Unrolling the general case logic results in a significant speed increase.
-			
-			uint16 *dPtr = &curRowBuf [1] [0];
+// Burst Photo modified (added): returns the position of the next bit of the
+// scan, in bits from the start of the stream. The whole bytes in the bit
+// buffer are counted with their stuffed zero bytes, so the position does not
+// depend on how far ahead the bit buffer has been filled. The stream must be
+// in memory.
+
+template <SIMDType simd>
+uint64 dng_lossless_decoder<simd>::ScanPosition () const
+	{
+	
+	uint64 position = fStream->Position ();
+	
+	for (int32 bytes = bitsLeft >> 3; bytes > 0 && position > 0; bytes--)
+		{
+		
+		position--;
+		
+		if (position > 0 &&
+			fStreamData [position	 ] == 0 &&
+			fStreamData [position - 1] == 0xFF)
+			{
+			position--;
+			}
+		
+		}
+		
+	return (position << 3) - (bitsLeft & 7);
+	
+	}
+
+/*****************************************************************************/
+
+// Burst Photo modified (added): decodes rows, starting with the first row of
+// the restart interval with the given index, whose data starts at a byte
+// offset. The restart markers of the following intervals are processed like
+// in DecodeImage.
+
+template <SIMDType simd>
+void dng_lossless_decoder<simd>::DecodeIntervals (uint64 offset,
+												  uint32 interval,
+												  uint32 rows)
+	{
+	
+	SeekScan (offset);
+	
+	info.restartRowsToGo = info.restartInRows;
+	info.nextRestartNum	 = (int16) (interval & 7);
+	
+	DecodeRows ((int32) rows);
+	
+	}
+
+/*****************************************************************************/
+
+// Burst Photo modified (added): decodes up to count differences into buffer,
+// starting with the component fComponent. Stops before a difference that
+// starts at or after endPosition (in bits, as far as can be told without
+// ScanPosition) and once the end of the segment has been reached. The exact
+// positions of the first positionCount differences are stored in positions.
+// Returns the number of differences decoded.
+
+template <SIMDType simd>
+uint32 dng_lossless_decoder<simd>::DecodeDifferences (uint16 *buffer,
+													  uint32 count,
+													  uint64 endPosition,
+													  uint64 *positions,
+													  uint32 positionCount)
+	{
+	
+	HuffmanTable *ht [4];
+	
+	const int32 *lookup [4];
+	
+	FindTables (ht, lookup);
+	
+	int32 compsInScan = info.compsInScan;
+	
+	int32 curComp = fComponent;
+	
+	uint32 index = 0;
+	
+	while (index < count &&
+		   !fHitMarker &&
+		   (fStream->Position () << 3) - bitsLeft < endPosition)
+		{
+		
+		if (index < positionCount)
+			{
+			positions [index] = ScanPosition ();
+			}
+			
+		buffer [index++] = (uint16) DecodeDifference (lookup [curComp], ht [curComp]);
+		
+		if (++curComp == compsInScan)
+			{
+			curComp = 0;
+			}
+		
+		}
+		
+	fComponent = curComp;
+	
+	return index;
+	
+	}
+
+/*****************************************************************************/
+
+// Burst Photo modified (added): decodes the next difference, of the component
+// fComponent.
+
+template <SIMDType simd>
+uint16 dng_lossless_decoder<simd>::NextDifference ()
+	{
+	
+	JpegComponentInfo *compptr = info.curCompInfo [info.MCUmembership [fComponent]];
+	
+	if (++fComponent == info.compsInScan)
+		{
+		fComponent = 0;
+		}
+		
+	return (uint16) DecodeDifference (fLookupBuffer [compptr->dcTblNo].Buffer_int32 (),
+									  info.dcHuffTblPtrs [compptr->dcTblNo]);
+	
+	}
+
+/*****************************************************************************/
+
+// Burst Photo modified (added): adds the predictors to the differences of the
+// whole scan and outputs the rows, like DecodeImage. The differences are
+// given as consecutive runs, whose counts add up to the number of samples.
+
+template <SIMDType simd>
+void dng_lossless_decoder<simd>::PutDifferences (const uint16 * const *runData,
+												 const uint32 *runCount)
+	{
+	
+	#define swap(type,a,b) {type c; c=(a); (a)=(b); (b)=c;}
+
+	int32 numCOL	  = info.imageWidth;
+	int32 numROW	  = info.imageHeight;
+	int32 compsInScan = info.compsInScan;
+	
+	uint32 rowSamples = (uint32) (numCOL * compsInScan);
+	
+	MCU *prevRowBuf = mcuROW1;
+	MCU *curRowBuf	= mcuROW2;
+	
+	const uint16 *sPtr = runData [0];
+	
+	uint32 sCount = runCount [0];
+	
+	for (int32 row = 0; row < numROW; row++)
+		{
+		
+		// Gather the differences of the row.
+		
+		uint16 *dPtr = &curRowBuf [0] [0];
+		
+		uint32 samples = rowSamples;
+		
+		while (samples)
+			{
+			
+			while (sCount == 0)
+				{
+				sPtr   = *(++runData);
+				sCount = *(++runCount);
+				}
+				
+			uint32 count = Min_uint32 (samples, sCount);
+			
+			memcpy (dPtr, sPtr, count * sizeof (uint16));
+			
+			dPtr	+= count;
+			sPtr	+= count;
+			sCount	-= count;
+			samples -= count;
+			
+			}
+			
+		dPtr = &curRowBuf [0] [0];
+		
+		// Add the predictors, see DecodeFirstRow and DecodeRows.
+		
+		if (row == 0)
+			{
+			
+			int32 Pr = info.dataPrecision;
+			int32 Pt = info.Pt;
+			
+			for (int32 curComp = 0; curComp < compsInScan; curComp++)
+				{
+				dPtr [curComp] = (ComponentType) (dPtr [curComp] + (1 << (Pr-Pt-1)));
+				}
+				
+			for (uint32 j = compsInScan; j < rowSamples; j++)
+				{
+				dPtr [j] = (ComponentType) (dPtr [j] + dPtr [j - compsInScan]);
+				}
+			
+			}
+			
+		else
+			{
+			
+			for (int32 curComp = 0; curComp < compsInScan; curComp++)
+				{
+				dPtr [curComp] = (ComponentType) (dPtr [curComp] + prevRowBuf [0] [curComp]);
+				}
+				
+			if (info.Ss == 1)
+				{
+				
+				for (uint32 j = compsInScan; j < rowSamples; j++)
+					{
+					dPtr [j] = (ComponentType) (dPtr [j] + dPtr [j - compsInScan]);
+					}
+				
+				}
+				
+			else
+				{
+				
+				for (int32 col = 1; col < numCOL; col++)
+					{
+					
+					for (int32 curComp = 0; curComp < compsInScan; curComp++)
+						{
+						
+						int32 predictor = QuickPredict (col,
+														curComp,
+														curRowBuf,
+														prevRowBuf);
+														
+						curRowBuf [col] [curComp] = (ComponentType) (curRowBuf [col] [curComp] + predictor);
+						
+						}
+						
+					}
+				
+				}
+			
+			}
+			
+		PmPutRow (curRowBuf, compsInScan, numCOL, row);
+		
+		swap (MCU *, prevRowBuf, curRowBuf);
+		
+		}
+		
+	#undef swap
+	
+	}
+
+/*****************************************************************************/
+
+// Burst Photo modified (added): spooler that stores the data in a buffer.
+
+class dng_lossless_buffer_spooler: public dng_spooler
+	{
+	
+	private:
+	
+		uint8 *fBuffer;
+		
+		uint32 fSize;
+		
+	public:
+	
+		dng_lossless_buffer_spooler (void *buffer,
+									 uint32 size)
+									 
+			:	fBuffer ((uint8 *) buffer)
+			,	fSize	(size)
+			
+			{
+			}
+			
+		virtual ~dng_lossless_buffer_spooler ()
+			{
+			}
+			
+		virtual void Spool (const void *data,
+							uint32 count)
+			{
+			
+			if (count > fSize)
+				{
+				ThrowBadFormat ();
+				}
+				
+			memcpy (fBuffer, data, count);
+			
+			fBuffer += count;
+			fSize	-= count;
+			
+			}
+	
+	};
+
+/*****************************************************************************/
+
+// Burst Photo modified (added): decodes the restart intervals of a scan on
+// several threads. The intervals are decoded in groups of consecutive
+// intervals, each by a decoder of its own, into the rows of the group.
+
+template <SIMDType simd>
+class dng_lossless_restart_task: public dng_area_task,
+								 private dng_uncopyable
+	{
+	
+	private:
+	
+		const uint8 *fData;
+		
+		uint32 fDataSize;
+		
+		bool fBug16;
+		
+		const uint64 *fIntervalOffset;
+		
+		uint32 fIntervalCount;
+		
+		uint32 fIntervalsPerGroup;
+		
+		uint32 fGroupCount;
+		
+		uint32 fRestartInRows;
+		
+		uint32 fRows;
+		
+		uint32 fRowSize;
+		
+		uint8 *fBuffer;
+		
+		std::atomic<uint32> fNextGroup;
+		
+		uint64 fEndPosition;
+		
+	public:
+	
+		dng_lossless_restart_task (const uint8 *data,
+								   uint32 dataSize,
+								   bool bug16,
+								   const uint64 *intervalOffset,
+								   uint32 intervalCount,
+								   uint32 groupCount,
+								   uint32 restartInRows,
+								   uint32 rows,
+								   uint32 rowSize,
+								   void *buffer)
+								   
+			:	dng_area_task ("dng_lossless_restart_task")
+			
+			,	fData			   (data)
+			,	fDataSize		   (dataSize)
+			,	fBug16			   (bug16)
+			,	fIntervalOffset	   (intervalOffset)
+			,	fIntervalCount	   (intervalCount)
+			,	fIntervalsPerGroup ((intervalCount + groupCount - 1) / groupCount)
+			,	fGroupCount		   ((intervalCount + fIntervalsPerGroup - 1) / fIntervalsPerGroup)
+			,	fRestartInRows	   (restartInRows)
+			,	fRows			   (rows)
+			,	fRowSize		   (rowSize)
+			,	fBuffer			   ((uint8 *) buffer)
+			,	fNextGroup		   (0)
+			,	fEndPosition	   (0)
+			
+			{
+			
+			fMinTaskArea = 16 * 16;
+			fUnitCell	 = dng_point (16, 16);
+			fMaxTileSize = dng_point (16, 16);
+			
+			}
+			
+		uint32 GroupCount () const
+			{
+			return fGroupCount;
+			}
+			
+		// Position in the data after the last interval.
+			
+		uint64 EndPosition () const
+			{
+			return fEndPosition;
+			}
+			
+		virtual void Process (uint32 /* threadIndex */,
+							  const dng_rect & /* tile */,
+							  dng_abort_sniffer *sniffer)
+			{
+			
+			while (true)
+				{
+				
+				uint32 group = fNextGroup++;
+				
+				if (group >= fGroupCount)
+					{
+					return;
+					}
+					
+				dng_abort_sniffer::SniffForAbort (sniffer);
+				
+				uint32 firstInterval = group * fIntervalsPerGroup;
+				
+				uint32 lastInterval = Min_uint32 (firstInterval + fIntervalsPerGroup,
+												  fIntervalCount);
+												  
+				uint32 firstRow = firstInterval * fRestartInRows;
+				
+				uint32 rows = Min_uint32 (lastInterval * fRestartInRows, fRows) - firstRow;
+				
+				dng_stream stream (fData, fDataSize);
+				
+				dng_lossless_buffer_spooler spooler (fBuffer + firstRow * fRowSize,
+													 rows * fRowSize);
+				
+				dng_lossless_decoder<simd> decoder (&stream,
+													&spooler,
+													fBug16);
+													
+				uint32 imageWidth;
+				uint32 imageHeight;
+				uint32 imageChannels;
+				
+				decoder.StartRead (imageWidth,
+								   imageHeight,
+								   imageChannels);
+								   
+				decoder.DecodeIntervals (fIntervalOffset [firstInterval],
+										 firstInterval,
+										 rows);
+										 
+				if (lastInterval == fIntervalCount)
+					{
+					fEndPosition = stream.Position ();
+					}
+				
+				}
+			
+			}
+	
+	};
+
+/*****************************************************************************/
+
+// Burst Photo modified (added): makes sure that a block holds at least count
+// differences, keeping the first used ones.
+
+static void ReserveDifferences (dng_host &host,
+								AutoPtr<dng_memory_block> &block,
+								uint32 used,
+								uint32 count)
+	{
+	
+	uint32 capacity = block.Get () ? block->LogicalSize () / (uint32) sizeof (uint16) : 0;
+	
+	if (capacity >= count)
+		{
+		return;
+		}
+		
+	capacity = Max_uint32 (count, capacity + capacity / 2 + 256);
+	
+	AutoPtr<dng_memory_block> newBlock (host.Allocate (SafeUint32Mult (capacity, (uint32) sizeof (uint16))));
+	
+	if (used)
+		{
+		memcpy (newBlock->Buffer (), block->Buffer (), used * sizeof (uint16));
+		}
+		
+	block.Reset (newBlock.Release ());
+	
+	}
+
+/*****************************************************************************/
+
+// Burst Photo modified (added): decodes the differences of a scan without
+// restart markers on several threads. The data of the scan is split into
+// parts of about the same size, and the decoder of each part starts at the
+// first byte of the part, without knowing where a difference starts or which
+// component it belongs to. It usually decodes the same differences as a
+// decoder that started at the beginning of the scan after a few differences,
+// because Huffman codes synchronize themselves. Resolve finds the point where
+// they agree for each part, see FinishReadInParts.
+
+template <SIMDType simd>
+class dng_lossless_speculative_task: public dng_area_task,
+									 private dng_uncopyable
+	{
+	
+	private:
+	
+		struct part
+			{
+			
+			AutoPtr<dng_stream> fStream;
+			
+			AutoPtr<dng_lossless_decoder<simd> > fDecoder;
+			
+			// Differences decoded from the start of the part, the first
+			// fFirst of which are wrong.
+			
+			AutoPtr<dng_memory_block> fDifferences;
+			
+			uint32 fCount;
+			
+			uint32 fFirst;
+			
+			// Bit positions at which the first differences start.
+			
+			uint64 fPositions [kSyncPositions];
+			
+			uint32 fPositionCount;
 			
-			int32 prev0 = dPtr [-2];
-			int32 prev1 = dPtr [-1];
+			// Differences decoded again by the decoder of the part before,
+			// up to the point where they agree.
 			
-			for (int32 col = 1; col < numCOL; col++)
+			AutoPtr<dng_memory_block> fRepeated;
+			
+			uint32 fRepeatedCount;
+			
+			part ()
+				:	fCount		   (0)
+				,	fFirst		   (0)
+				,	fPositionCount (0)
+				,	fRepeatedCount (0)
+				{
+				}
+			
+			};
+	
+		dng_host &fHost;
+		
+		const uint8 *fData;
+		
+		uint32 fDataSize;
+		
+		bool fBug16;
+		
+		uint32 fSampleCount;
+		
+		uint32 fPartCount;
+		
+		AutoArray<uint64> fPartStart;
+		
+		AutoArray<part> fParts;
+		
+		// Differences decoded at the end of the scan, see Resolve.
+		
+		AutoPtr<dng_memory_block> fTail;
+		
+		std::atomic<uint32> fNextPart;
+		
+	public:
+	
+		dng_lossless_speculative_task (dng_host &host,
+									   const uint8 *data,
+									   uint32 dataSize,
+									   bool bug16,
+									   uint32 sampleCount,
+									   uint64 scanStart,
+									   uint64 scanEnd,
+									   uint32 partCount)
+									   
+			:	dng_area_task ("dng_lossless_speculative_task")
+			
+			,	fHost		 (host)
+			,	fData		 (data)
+			,	fDataSize	 (dataSize)
+			,	fBug16		 (bug16)
+			,	fSampleCount (sampleCount)
+			,	fPartCount	 (partCount)
+			,	fPartStart	 ()
+			,	fParts		 ()
+			,	fTail		 ()
+			,	fNextPart	 (0)
+			
+			{
+			
+			fMinTaskArea = 16 * 16;
+			fUnitCell	 = dng_point (16, 16);
+			fMaxTileSize = dng_point (16, 16);
+			
+			fPartStart.Reset (partCount + 1);
+			
+			fParts.Reset (partCount);
+			
+			for (uint32 index = 0; index <= partCount; index++)
 				{
 				
-				int32 s = HuffDecode (ht [0]);
+				uint64 start = scanStart + (scanEnd - scanStart) * index / partCount;
+				
+				// Do not start a part at a stuffed zero byte.
 				
-				if (s)
+				if (index > 0 && index < partCount && fData [start - 1] == 0xFF)
 					{
+					start++;
+					}
 					
-					int32 d;
-
-					if (s == 16 && !fBug16)
+				fPartStart [index] = start;
+				
+				}
+			
+			}
+			
+		virtual void Process (uint32 /* threadIndex */,
+							  const dng_rect & /* tile */,
+							  dng_abort_sniffer *sniffer)
+			{
+			
+			while (true)
+				{
+				
+				uint32 index = fNextPart++;
+				
+				if (index >= fPartCount)
+					{
+					return;
+					}
+					
+				dng_abort_sniffer::SniffForAbort (sniffer);
+				
+				if (index == 0)
+					{
+					DecodePart (index);
+					continue;
+					}
+				
+				// The decoder of a part can run into invalid codes before it
+				// agrees with the decoder of the part before. The part is
+				// then decoded again by Resolve.
+				
+				try
+					{
+					DecodePart (index);
+					}
+					
+				catch (const dng_exception &except)
+					{
+					
+					if (except.ErrorCode () != dng_error_bad_format &&
+						except.ErrorCode () != dng_error_end_of_file)
 						{
-						d = -32768;
+						throw;
 						}
+						
+					fParts [index].fCount		  = 0;
+					fParts [index].fFirst		  = 0;
+					fParts [index].fPositionCount = 0;
 					
-					else
+					}
+				
+				}
+			
+			}
+			
+		// Finds the differences of the scan in the decoded parts and passes
+		// them to the decoder to output the rows. Returns the position in
+		// the data after the last difference.
+			
+		uint64 Resolve (dng_lossless_decoder<simd> &decoder)
+			{
+			
+			int32 compsInScan = decoder.info.compsInScan;
+			
+			// The component of a difference only matters for the
+			// synchronization if the components use different tables.
+			// Encoders often write a table per component, even if the
+			// tables are the same.
+			
+			bool sameTables = true;
+			
+			const HuffmanTable *table0 = decoder.info.dcHuffTblPtrs [decoder.info.curCompInfo [0]->dcTblNo];
+			
+			for (int32 ci = 1; ci < compsInScan; ci++)
+				{
+				
+				const HuffmanTable *table = decoder.info.dcHuffTblPtrs [decoder.info.curCompInfo [ci]->dcTblNo];
+				
+				if (table == table0)
+					{
+					continue;
+					}
+					
+				uint32 codes = 0;
+				
+				for (uint32 l = 1; l <= 16; l++)
+					{
+					codes += table0->bits [l];
+					}
+				
+				if (memcmp (table->bits, table0->bits, sizeof (table0->bits)) != 0 ||
+					memcmp (table->huffval, table0->huffval, Min_uint32 (codes, 256)) != 0)
+					{
+					sameTables = false;
+					}
+				
+				}
+			
+			// The decoder of the first part starts at the beginning of the
+			// scan. The decoder of the last part that has been found to
+			// agree with it decodes the differences of the next part that
+			// are wrong.
+			
+			dng_lossless_decoder<simd> *current = fParts [0].fDecoder.Get ();
+			
+			uint64 total = fParts [0].fCount;
+			
+			for (uint32 index = 1; index < fPartCount && total < fSampleCount; index++)
+				{
+				
+				part &p = fParts [index];
+				
+				bool synced = false;
+				
+				uint32 j = 0;
+				
+				while (total < fSampleCount)
+					{
+					
+					uint64 position = current->ScanPosition ();
+					
+					while (j < p.fPositionCount && p.fPositions [j] < position)
 						{
-						d = get_bits (s);
-						HuffExtend (d, s);
+						j++;
 						}
-
-					prev0 += d;
+						
+					if (j == p.fPositionCount)
+						{
+						break;
+						}
+						
+					if (p.fPositions [j] == position &&
+						(sameTables || current->fComponent == (int32) (j % compsInScan)))
+						{
+						synced = true;
+						break;
+						}
+						
+					ReserveDifferences (fHost,
+										p.fRepeated,
+										p.fRepeatedCount,
+										p.fRepeatedCount + 1);
+										
+					p.fRepeated->Buffer_uint16 () [p.fRepeatedCount++] = current->NextDifference ();
+					
+					total++;
 					
 					}
 					
-				s = HuffDecode (ht [1]);
-				
-				if (s)
+				if (synced)
 					{
 					
-					int32 d;
-
-					if (s == 16 && !fBug16)
+					uint32 component = (uint32) current->fComponent + (p.fCount - j) % compsInScan;
+					
+					p.fFirst = j;
+					
+					total += p.fCount - j;
+					
+					current = p.fDecoder.Get ();
+					
+					current->fComponent = (int32) (component % compsInScan);
+					
+					}
+					
+				else
+					{
+					
+					// The decoders never agreed, so the rest of the part is
+					// decoded again.
+					
+					p.fFirst = p.fCount;
+					
+					while (total < fSampleCount)
 						{
-						d = -32768;
+						
+						uint32 count = (uint32) Min_uint64 (fSampleCount - total, 64 * 1024);
+						
+						ReserveDifferences (fHost,
+											p.fRepeated,
+											p.fRepeatedCount,
+											p.fRepeatedCount + count);
+											
+						uint32 decoded = current->DecodeDifferences (p.fRepeated->Buffer_uint16 () + p.fRepeatedCount,
+																	 count,
+																	 fPartStart [index + 1] << 3,
+																	 NULL,
+																	 0);
+																	 
+						p.fRepeatedCount += decoded;
+						
+						total += decoded;
+						
+						if (decoded < count)
+							{
+							break;
+							}
+						
 						}
 					
-					else
+					}
+				
+				}
+				
+			// If the scan ends before all differences have been decoded, the
+			// bit buffer is filled with zero bits, like in DecodeImage.
+			
+			uint32 tailCount = 0;
+			
+			if (total < fSampleCount)
+				{
+				
+				tailCount = (uint32) (fSampleCount - total);
+				
+				ReserveDifferences (fHost,
+									fTail,
+									0,
+									tailCount);
+									
+				uint16 *tail = fTail->Buffer_uint16 ();
+				
+				for (uint32 k = 0; k < tailCount; k++)
+					{
+					tail [k] = current->NextDifference ();
+					}
+				
+				}
+				
+			// Pass the differences in the order of the scan.
+				
+			std::vector<const uint16 *> runData;
+			std::vector<uint32> runCount;
+			
+			uint32 remaining = fSampleCount;
+			
+			for (uint32 index = 0; index <= fPartCount; index++)
+				{
+				
+				const uint16 *data [2];
+				uint32 count [2];
+				
+				if (index < fPartCount)
+					{
+					
+					part &p = fParts [index];
+					
+					data  [0] = p.fRepeated.Get () ? p.fRepeated->Buffer_uint16 () : NULL;
+					count [0] = p.fRepeatedCount;
+					
+					data  [1] = p.fDifferences.Get () ? p.fDifferences->Buffer_uint16 () + p.fFirst : NULL;
+					count [1] = p.fCount - p.fFirst;
+					
+					}
+					
+				else
+					{
+					
+					data  [0] = fTail.Get () ? fTail->Buffer_uint16 () : NULL;
+					count [0] = tailCount;
+					
+					data  [1] = NULL;
+					count [1] = 0;
+					
+					}
+					
+				for (uint32 k = 0; k < 2; k++)
+					{
+					
+					count [k] = Min_uint32 (count [k], remaining);
+					
+					if (count [k])
 						{
-						d = get_bits (s);
-						HuffExtend (d, s);
+						
+						runData.push_back (data [k]);
+						runCount.push_back (count [k]);
+						
+						remaining -= count [k];
+						
 						}
-
-					prev1 += d;
 					
 					}
 				
-				dPtr [0] = (uint16) prev0;
-				dPtr [1] = (uint16) prev1;
+				}
+				
+			decoder.PutDifferences (&runData [0],
+									&runCount [0]);
+									
+			return current->fStream->Position ();
+			
+			}
+			
+	private:
+	
+		void DecodePart (uint32 index)
+			{
+			
+			part &p = fParts [index];
+			
+			p.fStream.Reset (new dng_stream (fData, fDataSize));
+			
+			p.fDecoder.Reset (new dng_lossless_decoder<simd> (p.fStream.Get (),
+															  NULL,
+															  fBug16));
+															  
+			uint32 imageWidth;
+			uint32 imageHeight;
+			uint32 imageChannels;
+			
+			p.fDecoder->StartRead (imageWidth,
+								   imageHeight,
+								   imageChannels);
+								   
+			uint64 start = fPartStart [index	];
+			uint64 end	 = fPartStart [index + 1];
+			
+			if (index > 0)
+				{
+				p.fDecoder->SeekScan (start);
+				}
+				
+			// Start with the expected number of differences of the part.
+				
+			uint64 expected = (uint64) fSampleCount * (end - start) /
+							  (fPartStart [fPartCount] - fPartStart [0]);
+			
+			uint32 capacity = (uint32) Min_uint64 (fSampleCount,
+												   expected + expected / 8 + 1024);
+			
+			while (true)
+				{
+				
+				ReserveDifferences (fHost,
+									p.fDifferences,
+									p.fCount,
+									capacity);
+									
+				uint32 positionCount = p.fCount < kSyncPositions ? kSyncPositions - p.fCount : 0;
+									
+				p.fCount += p.fDecoder->DecodeDifferences (p.fDifferences->Buffer_uint16 () + p.fCount,
+														   capacity - p.fCount,
+														   end << 3,
+														   positionCount ? p.fPositions + p.fCount : NULL,
+														   positionCount);
+														   
+				if (p.fCount < capacity || capacity == fSampleCount)
+					{
+					break;
+					}
+					
+				capacity = (uint32) Min_uint64 (fSampleCount,
+												(uint64) capacity + capacity / 2);
+				
+				}
+				
+			// The differences of the first part are right, the others are
+			// not known to be right until Resolve.
+				
+			p.fFirst = index == 0 ? 0 : p.fCount;
+			
+			p.fPositionCount = Min_uint32 (p.fCount, kSyncPositions);
+			
+			}
+			
+	};
+
+/*****************************************************************************/
+
+// Burst Photo modified (added): decodes the scan on several threads of the
+// host, instead of FinishRead. Returns false without decoding anything if
+// the scan is too small or cannot be decoded in parts.
+//
+// - If the scan has restart intervals, the restart markers are found first,
+//   and groups of intervals are decoded by dng_lossless_restart_task.
+// - Otherwise the differences are decoded by dng_lossless_speculative_task.
+//   The decoder of the part before each part, which is known to be right,
+//   decodes the differences of the part until its bit position matches the
+//   position of a difference decoded for the part, from where on the
+//   differences of the part are right as well. If that never happens, the
+//   decoder of the part before decodes the whole part. The predictors are
+//   added as the rows are output, on a single thread.
+
+template <SIMDType simd>
+bool dng_lossless_decoder<simd>::FinishReadInParts (dng_host &host,
+													uint64 startOfData,
+													uint64 endOfData)
+	{
+	
+	uint32 threadCount = host.PerformAreaTaskThreads ();
+	
+	uint64 sampleCount = (uint64) info.imageWidth  *
+						 (uint64) info.imageHeight *
+						 (uint64) info.compsInScan;
+	
+	if (threadCount < 2 ||
+		sampleCount * sizeof (uint16) < kMinPartsDecodedSize ||
+		sampleCount > 0x7FFFFFFF ||
+		!CanDecodeInParts ())
+		{
+		return false;
+		}
+		
+	// Restart intervals that do not end at the end of a row are not
+	// supported by DecodeImage either.
+		
+	if (info.restartInterval && !info.restartInRows)
+		{
+		return false;
+		}
+		
+	uint64 scanStart = fStream->Position ();
+	
+	if (scanStart < startOfData ||
+		scanStart >= endOfData ||
+		endOfData > fStream->Length ())
+		{
+		return false;
+		}
+		
+	// The parts are decoded from memory. The data is read up to the end of
+	// the tile, if it is not in memory already.
+	
+	AutoPtr<dng_memory_block> block;
+	
+	const uint8 *data;
+	
+	uint64 dataSize;
+	
+	if (fStreamData)
+		{
+		
+		data = fStreamData + startOfData;
+		
+		dataSize = Min_uint64 (fStreamLength - startOfData, 0xFFFFFFFF);
+		
+		}
+		
+	else
+		{
+		
+		dataSize = endOfData - startOfData;
+		
+		if (dataSize > 0xFFFFFFFF)
+			{
+			return false;
+			}
+			
+		block.Reset (host.Allocate ((uint32) dataSize));
+		
+		fStream->SetReadPosition (startOfData);
+		
+		fStream->Get (block->Buffer (), (uint32) dataSize);
+		
+		fStream->SetReadPosition (scanStart);
+		
+		data = block->Buffer_uint8 ();
+		
+		}
+		
+	scanStart -= startOfData;
+	
+	uint64 scanEnd = Min_uint64 (endOfData - startOfData, dataSize);
+	
+	if (scanStart >= scanEnd)
+		{
+		return false;
+		}
+		
+	uint64 endPosition;
+		
+	uint32 intervalCount = 1;
+	
+	if (info.restartInRows)
+		{
+		
+		intervalCount = (uint32) ((info.imageHeight + info.restartInRows - 1) /
+								  info.restartInRows);
+								  
+		}
+	
+	if (intervalCount > 1)
+		{
+		
+		// Find the start of the data of each interval, after the restart
+		// marker of the interval before.
+		
+		dng_memory_data intervalOffsetData (intervalCount, sizeof (uint64));
+		
+		uint64 *intervalOffset = intervalOffsetData.Buffer_uint64 ();
+		
+		intervalOffset [0] = scanStart;
+		
+		uint32 found = 1;
+		
+		uint64 position = scanStart;
+		
+		while (found < intervalCount && position + 1 < dataSize)
+			{
+			
+			const uint8 *marker = (const uint8 *) memchr (data + position,
+														  0xFF,
+														  (size_t) (dataSize - position - 1));
+														  
+			if (!marker)
+				{
+				break;
+				}
 				
-				dPtr += 2;
+			position = (uint64) (marker - data) + 1;
+			
+			uint8 code = data [position];
+			
+			// Skip stuffed zero bytes and fill bytes before a marker.
+			
+			if (code == 0 || code == 0xFF)
+				{
+				continue;
+				}
 				
+			if (code != M_RST0 + ((found - 1) & 7))
+				{
+				break;
 				}
 				
+			intervalOffset [found++] = ++position;
+			
 			}
 			
-		else
+		if (found < intervalCount)
 			{
+			return false;
+			}
 			
-			for (int32 col = 1; col < numCOL; col++)
-				{
-				
-				for (int32 curComp = 0; curComp < compsInScan; curComp++)
-					{
-					
-					// Section F.2.2.1: decode the difference
-
-					int32 d = 0;
-				
-					int32 s = HuffDecode (ht [curComp]);
-					
-					if (s)
-						{
-						
-						if (s == 16 && !fBug16)
-							{
-							d = -32768;
-							}
-						
-						else
-							{
-							d = get_bits (s);
-							HuffExtend (d, s);
-							}
-
-						}
-						
-					// Predict the pixel value.
-					
-					int32 predictor = QuickPredict (col,
-													curComp,
-													curRowBuf,
-													prevRowBuf);
-												  
-					// Save the difference.
-
-					curRowBuf [col] [curComp] = (ComponentType) (d + predictor);
-					
-					}
-					
-				}
-
+		uint32 rowSize = (uint32) (info.imageWidth * info.compsInScan) * (uint32) sizeof (uint16);
+			
+		AutoPtr<dng_memory_block> buffer (host.Allocate ((uint32) sampleCount * (uint32) sizeof (uint16)));
+		
+		dng_lossless_restart_task<simd> task (data,
+											  (uint32) dataSize,
+											  fBug16,
+											  intervalOffset,
+											  intervalCount,
+											  Min_uint32 (intervalCount, threadCount * 4),
+											  (uint32) info.restartInRows,
+											  (uint32) info.imageHeight,
+											  rowSize,
+											  buffer->Buffer ());
+											  
+		threadCount = Min_uint32 (threadCount, task.GroupCount ());
+		
+		host.PerformAreaTask (task,
+							  dng_rect (0, 0, 16, 16 * threadCount));
+							  
+		fSpooler->Spool (buffer->Buffer (),
+						 (uint32) sampleCount * (uint32) sizeof (uint16));
+						 
+		endPosition = task.EndPosition ();
+		
+		}
+		
+	else
+		{
+		
+		uint32 partCount = (uint32) Min_uint64 (threadCount * 4,
+												(scanEnd - scanStart) / kMinSpeculativePartSize);
+												
+		if (partCount < 2)
+			{
+			return false;
 			}
-
-		PmPutRow (curRowBuf, compsInScan, numCOL, row);
+			
+		dng_lossless_speculative_task<simd> task (host,
+												  data,
+												  (uint32) dataSize,
+												  fBug16,
+												  (uint32) sampleCount,
+												  scanStart,
+												  scanEnd,
+												  partCount);
+												  
+		threadCount = Min_uint32 (threadCount, partCount);
 		
-		swap (MCU *, prevRowBuf, curRowBuf);
+		host.PerformAreaTask (task,
+							  dng_rect (0, 0, 16, 16 * threadCount));
+							  
+		endPosition = task.Resolve (*this);
 		
 		}
 		
-	#undef swap
-	
-	}
-
-/*****************************************************************************/
-
-template <SIMDType simd>
-void dng_lossless_decoder<simd>::StartRead (uint32 &imageWidth,
-											uint32 &imageHeight,
-											uint32 &imageChannels)
-	{ 
-	
-	ReadFileHeader	  ();
-	ReadScanHeader	  ();
-	DecoderStructInit ();
-	HuffDecoderInit	  ();
-	
-	imageWidth	  = info.imageWidth;
-	imageHeight	  = info.imageHeight;
-	imageChannels = info.compsInScan;
+	fStream->SetReadPosition (startOfData + endPosition);
 	
-	}
-
-/*****************************************************************************/
-
-template <SIMDType simd>
-void dng_lossless_decoder<simd>::FinishRead ()
-	{
+	return true;
 	
-	DecodeImage ();
-		
 	}
 
 /*****************************************************************************/
@@ -2753,16 +4250,17 @@ class dng_lossless_encoder
 		int EmitBitsToBuffer (int buffered_bits,
 							  uint64 bit_buffer);
 
+		int Emit32BitsToBuffer (int buffered_bits,
+								uint64 bit_buffer);
+
 		int EncodeOneDiffToBuffer (int diff,
 								   HuffmanTable *dctbl,
 								   int buffered_bits,
 								   uint64 &bit_buffer);
 
 		void CountOneDiff (int diff, uint32 *countTable);
-
-		void EncodeOneDiff (int diff, HuffmanTable *dctbl);
 		
-		void FreqCountSet ();
+		void FreqCountSet (uint32 rowStep);
 
 		void HuffEncode ();
 
@@ -2848,8 +4346,13 @@ dng_lossless_encoder<simd>::dng_lossless_encoder (const uint16 *srcData,
 
 	// Maximum buffering for one row of output. Add one for carryover bits
 	// from previous row.
+	//
+	// Burst Photo modified: the Huffman tables can be built from some of
+	// the rows only, so any difference can have the longest code (16 bits)
+	// and 15 additional bits, which is 4 bytes, or 8 bytes with stuffed
+	// zero bytes.
 
-	size_t streamBufferExtent = srcCols * srcChannels * ((srcBitDepth + 7) / 8) * 2 * 2 + 1;
+	size_t streamBufferExtent = (size_t) srcCols * srcChannels * sizeof (uint32) * 2 + 1;
 
 	// Maximum output for header blocks and such.
 	// 296 is the DHT size, 64 is a round up of overhead.
@@ -3038,74 +4541,6 @@ inline void dng_lossless_encoder<simd>::CountOneDiff (int diff, uint32 *countTab
 
 /*****************************************************************************/
 
-/*
- *--------------------------------------------------------------
- *
- * EncodeOneDiff --
- *
- *	Encode a single difference value.
- *
- * Results:
- *	None.
- *
- * Side effects:
- *	None.
- *
- *--------------------------------------------------------------
- */
-
-template <SIMDType simd>
-inline void dng_lossless_encoder<simd>::EncodeOneDiff (int diff, HuffmanTable *dctbl)
-	{
-
-	// Encode the DC coefficient difference per section F.1.2.1
-	 
-	int temp  = diff;
-	int temp2 = diff;
-	
-	if (temp < 0)
-		{
-		
-		temp = -temp;
-		
-		// For a negative input, want temp2 = bitwise complement of
-		// abs (input).	 This code assumes we are on a two's complement
-		// machine.
-
-		temp2--;
-		
-		}
-
-	// Find the number of bits needed for the magnitude of the coefficient
-
-	int nbits = temp >= 256 ? numBitsTable [temp >> 8  ] + 8
-							: numBitsTable [temp & 0xFF];
-
-	// Emit the Huffman-coded symbol for the number of bits
-
-	EmitBits (dctbl->ehufco [nbits],
-			  dctbl->ehufsi [nbits]);
-
-	// Emit that number of bits of the value, if positive,
-	// or the complement of its magnitude, if negative.
-	
-	// If the number of bits is 16, there is only one possible difference
-	// value (-32786), so the lossless JPEG spec says not to output anything
-	// in that case.  So we only need to output the diference value if
-	// the number of bits is between 1 and 15.
-
-	if (nbits & 15)
-		{
-		
-		EmitBits (temp2 & (0x0FFFF >> (16 - nbits)),
-				  nbits);
-		
-		}
-
-	}
-
-/*****************************************************************************/
-
 template <SIMDType simd>
 inline int dng_lossless_encoder<simd>::EmitBitsToBuffer (int buffered_bits,
 														 uint64 bit_buffer)
@@ -3126,6 +4561,62 @@ inline int dng_lossless_encoder<simd>::EmitBitsToBuffer (int buffered_bits,
 
 /*****************************************************************************/
 
+// Burst Photo modified (added): writes the oldest 32 of the buffered bits.
+// Unless one of the 4 bytes is 0xFF and needs a stuffed zero byte, they are
+// stored without testing each byte.
+
+template <SIMDType simd>
+inline int dng_lossless_encoder<simd>::Emit32BitsToBuffer (int buffered_bits,
+														   uint64 bit_buffer)
+	{
+	
+	DNG_ASSERT(buffered_bits >= 32 && buffered_bits < 64, "buffered_bits out of range");
+	
+	uint32 word = (uint32) (bit_buffer >> (buffered_bits - 32));
+	
+	uint8 *dPtr = &streamBuffer [streamBufferOffset];
+	
+	// A byte of the word is 0xFF if the byte of its complement is zero.
+	
+	uint32 complement = ~word;
+	
+	if (((complement - 0x01010101) & word & 0x80808080) == 0)
+		{
+		
+		dPtr [0] = (uint8) (word >> 24);
+		dPtr [1] = (uint8) (word >> 16);
+		dPtr [2] = (uint8) (word >>	 8);
+		dPtr [3] = (uint8) (word	  );
+		
+		streamBufferOffset += 4;
+		
+		}
+		
+	else
+		{
+		
+		for (int shift = 24; shift >= 0; shift -= 8)
+			{
+			
+			uint8 c = (uint8) (word >> shift);
+			
+			streamBuffer [streamBufferOffset++] = c;
+			
+			if (c == 0xff)
+				{
+				streamBuffer [streamBufferOffset++] = 0x00;
+				}
+				
+			}
+		
+		}
+		
+	return buffered_bits - 32;
+	
+	}
+
+/*****************************************************************************/
+
 template <SIMDType simd>
 inline int dng_lossless_encoder<simd>::EncodeOneDiffToBuffer (int diff,
 															  HuffmanTable *dctbl,
@@ -3135,54 +4626,52 @@ inline int dng_lossless_encoder<simd>::EncodeOneDiffToBuffer (int diff,
 	
 	DNG_ASSERT(buffered_bits < 64, "buffered_bits too big(1)");
 	
+	// Burst Photo modified: the bits are written 32 at a time, so that at
+	// most 32 bits are buffered before the up to 31 bits of the difference
+	// are added.
+	
 	if (buffered_bits > 32)
 		{
-		buffered_bits = EmitBitsToBuffer(buffered_bits, bit_buffer);
+		buffered_bits = Emit32BitsToBuffer(buffered_bits, bit_buffer);
 		}
 		
 	// Encode the DC coefficient difference per section F.1.2.1
+	
+	// Burst Photo modified: the magnitude and the number of bits are found
+	// without branches, which are hard to predict for noisy images.
 
-	int temp  = diff;
-	int temp2 = diff;
-
-	if (temp < 0)
-		{
-
-		temp = -temp;
-
-		// For a negative input, want temp2 = bitwise complement of
-		// abs (input).	 This code assumes we are on a two's complement
-		// machine.
-
-		temp2--;
+	// For a negative input, want temp2 = bitwise complement of
+	// abs (input).	 This code assumes we are on a two's complement
+	// machine.
 
-		}
+	int sign  = diff >> 31;
+	int temp  = (diff ^ sign) - sign;
+	int temp2 = diff + sign;
 
 	// Find the number of bits needed for the magnitude of the coefficient
 
-	int nbits = temp >= 256 ? numBitsTable [temp >> 8  ] + 8
-							: numBitsTable [temp & 0xFF];
-
-	// Emit the Huffman-coded symbol for the number of bits
-	int bits_bits = dctbl->ehufsi [nbits];
-	bit_buffer <<= bits_bits;
-	bit_buffer |= dctbl->ehufco [nbits];
-	buffered_bits += bits_bits;
+	int shift = (temp >> 8) ? 8 : 0;
+	
+	int nbits = numBitsTable [temp >> shift] + shift;
 
-	// Emit that number of bits of the value, if positive,
-	// or the complement of its magnitude, if negative.
+	// Emit the Huffman-coded symbol for the number of bits, followed by
+	// that number of bits of the value, if positive, or the complement of
+	// its magnitude, if negative.
 
 	// If the number of bits is 16, there is only one possible difference
 	// value (-32786), so the lossless JPEG spec says not to output anything
 	// in that case.  So we only need to output the difference value if
 	// the number of bits is between 1 and 15.
+	
+	// Burst Photo modified: both are added at once, without a branch.
 
-	if (nbits & 15)
-		{
-		bit_buffer <<= nbits;
-		bit_buffer |= temp2 & (0x0FFFF >> (16 - nbits));
-		buffered_bits += nbits;
-		}
+	int bits_bits  = dctbl->ehufsi [nbits];
+	int value_bits = nbits & 15;
+	
+	bit_buffer <<= bits_bits + value_bits;
+	bit_buffer |= ((uint64) dctbl->ehufco [nbits] << value_bits) |
+				  (uint64) (temp2 & ((1 << value_bits) - 1));
+	buffered_bits += bits_bits + value_bits;
 
 	DNG_ASSERT(buffered_bits < 64, "buffered_bits too big(2)");
 	
@@ -3198,6 +4687,7 @@ inline int dng_lossless_encoder<simd>::EncodeOneDiffToBuffer (int diff,
  * FreqCountSet --
  *
  *		Count the times each category symbol occurs in this image.
+ *		Burst Photo modified: only every rowStep-th row is counted.
  *
  * Results:
  *	None.
@@ -3210,14 +4700,14 @@ inline int dng_lossless_encoder<simd>::EncodeOneDiffToBuffer (int diff,
  */
 
 template <SIMDType simd>
-void dng_lossless_encoder<simd>::FreqCountSet ()
+void dng_lossless_encoder<simd>::FreqCountSet (uint32 rowStep)
 	{
 	
 	memset (freqCount, 0, sizeof (freqCount));
 	
 	DNG_ASSERT ((int32)fSrcRows >= 0, "dng_lossless_encoder::FreqCountSet: fSrcRpws too large.");
 
-	for (int32 row = 0; row < (int32)fSrcRows; row++)
+	for (int32 row = 0; row < (int32)fSrcRows; row += (int32) rowStep)
 		{
 		
 		const uint16 *sPtr = fSrcData + row * fSrcRowStep;
@@ -3324,14 +4814,11 @@ void dng_lossless_encoder<simd>::HuffEncode ()
 	
 	DNG_ASSERT ((int32)fSrcRows >= 0, "dng_lossless_encoder::HuffEncode: fSrcRows too large.");
 
-	uint64 bit_buffer = 0;
-	int buffered_bits = 0;
+	// Burst Photo modified: all numbers of channels use the bit buffer
+	// of the unrolled case of two channels.
 
-	if (fSrcChannels == 2)
-		{
-		bit_buffer = huffPutBuffer;
-		buffered_bits = (int) huffPutBits;
-		}
+	uint64 bit_buffer = huffPutBuffer;
+	int buffered_bits = (int) huffPutBits;
 
 	for (int32 row = 0; row < (int32)fSrcRows; row++)
 		{
@@ -3383,8 +4870,6 @@ void dng_lossless_encoder<simd>::HuffEncode ()
 					
 				}
 			
-			buffered_bits = EmitBitsToBuffer(buffered_bits, bit_buffer);
-
 			}
 			
 		// General case.
@@ -3402,7 +4887,7 @@ void dng_lossless_encoder<simd>::HuffEncode ()
 					
 					int16 diff = (int16) (pixel - predictor [channel]);
 					
-					EncodeOneDiff (diff, &huffTable [channel]);
+					buffered_bits = EncodeOneDiffToBuffer (diff, &huffTable [channel], buffered_bits, bit_buffer);
 					
 					predictor [channel] = pixel;
 					
@@ -3414,15 +4899,14 @@ void dng_lossless_encoder<simd>::HuffEncode ()
 				
 			}
 			
+		buffered_bits = EmitBitsToBuffer(buffered_bits, bit_buffer);
+
 		FlushBuffer();
 		
 		}
   
-	if (fSrcChannels == 2)
-		{
-		huffPutBuffer = bit_buffer;
-		huffPutBits = buffered_bits;
-		}
+	huffPutBuffer = bit_buffer;
+	huffPutBits = buffered_bits;
 
 	FlushBits ();
 	
@@ -3668,6 +5152,9 @@ void dng_lossless_encoder<simd>::GenHuffCoding (HuffmanTable *htbl, uint32 *freq
  *	uses this optimal Huffman table and counting table to find
  *	the best PSV. 
  *
+ *	Burst Photo modified: large images are counted on some of the
+ *	rows only.
+ *
  * Results:
  *	Optimal Huffman tables are retured in cPtr->dcHuffTblPtrs[tbl].
  *	Best PSV is retured in cPtr->Ss.
@@ -3683,14 +5170,41 @@ void dng_lossless_encoder<simd>::HuffOptimize ()
 	{
 	
 	// Collect the frequency counts.
+	
+	uint64 sampleCount = (uint64) fSrcRows * fSrcCols * fSrcChannels;
+	
+	uint32 rowStep = sampleCount >= kMinSampledFreqCount ? kFreqCountRowStep : 1;
 	 
-	FreqCountSet ();
+	FreqCountSet (rowStep);
 	
 	// Generate Huffman encoding tables.
 	
 	for (uint32 channel = 0; channel < fSrcChannels; channel++)
 		{
 		
+		// If rows have not been counted, any category can occur. Each one
+		// gets a share of the count, which also keeps the codes of rare
+		// categories short enough.
+		
+		if (rowStep > 1)
+			{
+			
+			uint32 total = 0;
+			
+			for (uint32 j = 0; j <= 16; j++)
+				{
+				total += freqCount [channel] [j];
+				}
+				
+			uint32 minCount = Max_uint32 (total >> 10, 1);
+			
+			for (uint32 j = 0; j <= 16; j++)
+				{
+				freqCount [channel] [j] = Max_uint32 (freqCount [channel] [j], minCount);
+				}
+			
+			}
+		
 		try
 			{
 			
@@ -4042,13 +5556,16 @@ void DecodeLosslessJPEG (dng_stream &stream,
 						 uint32 minDecodedSize,
 						 uint32 maxDecodedSize,
 						 bool bug16,
-						 uint64 endOfData)
+						 uint64 endOfData,
+						 dng_host *host)
 	{
 
 	dng_lossless_decoder<simd> decoder (&stream,
 										&spooler,
 										bug16);
 	
+	uint64 startOfData = stream.Position ();
+	
 	uint32 imageWidth;
 	uint32 imageHeight;
 	uint32 imageChannels;
@@ -4068,7 +5585,17 @@ void DecodeLosslessJPEG (dng_stream &stream,
 		ThrowBadFormat ();
 		}
 	
-	decoder.FinishRead ();
+	// Burst Photo modified: large images are decoded on several threads, if
+	// the host has more than one.
+	
+	if (!host || !decoder.FinishReadInParts (*host,
+											  startOfData,
+											  endOfData))
+		{
+		
+		decoder.FinishRead ();
+		
+		}
 	
 	uint64 streamPos = stream.Position ();
 	
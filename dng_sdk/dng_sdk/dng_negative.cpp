@@ -34,6 +34,7 @@
 #include "dng_resample.h"
 #include "dng_safe_arithmetic.h"
 #include "dng_sdk_limits.h"
+#include "dng_simple_image.h"
 #include "dng_tag_codes.h"
 #include "dng_tag_values.h"
 #include "dng_tile_iterator.h"
@@ -1865,7 +1866,7 @@ class dng_find_new_raw_image_digest_task : public dng_area_task
 		
 		AutoArray<dng_fingerprint> fTileHash;
 		
-		AutoPtr<dng_memory_block> fBufferData [kMaxMPThreads];
+		AutoArray<AutoPtr<dng_memory_block> > fBufferData;
 	
 	public:
 	
@@ -1918,6 +1919,8 @@ class dng_find_new_raw_image_digest_task : public dng_area_task
 								   fImage.Planes (),
 								   padNone);
 								
+			fBufferData.Reset (threadCount);
+			
 			for (uint32 index = 0; index < threadCount; index++)
 				{
 				
@@ -1941,6 +1944,44 @@ class dng_find_new_raw_image_digest_task : public dng_area_task
 			
 			uint32 tileIndex = rowIndex * fTilesAcross + colIndex;
 			
+			// Burst Photo modified (added): images in memory are hashed in
+			// place, one row at a time.  This feeds the same bytes to the
+			// digest as the copy below, without copying every tile first.
+			
+			#if !qDNGBigEndian
+			
+			const dng_simple_image *simpleImage = dynamic_cast<const dng_simple_image *> (&fImage);
+			
+			if (simpleImage && simpleImage->PixelType () == fPixelType)
+				{
+				
+				const dng_pixel_buffer &imageBuffer = simpleImage->fBuffer;
+				
+				const uint32 rowBytes = tile.W () * fPixelSize;
+				
+				dng_md5_printer printer;
+				
+				for (uint32 plane = 0; plane < fImage.Planes (); plane++)
+					{
+					
+					for (int32 row = tile.t; row < tile.b; row++)
+						{
+						
+						printer.Process (imageBuffer.ConstPixel (row, tile.l, plane),
+										 rowBytes);
+						
+						}
+					
+					}
+					
+				fTileHash [tileIndex] = printer.Result ();
+				
+				return;
+				
+				}
+			
+			#endif
+			
 			dng_pixel_buffer buffer (tile, 
 									 0, 
 									 fImage.Planes (),
@@ -39,12 +39,434 @@
 
 /******************************************************************************/
 
+// Burst Photo modified (added): vector versions of the horizontal predictor.
+// Decoding a row is a running sum over the samples that are a channel count
+// apart. Each vector is summed in log2 steps of shifts and additions, and the
+// sum of all vectors before it is added afterwards, so only one addition per
+// vector depends on the previous vector. A vector must hold whole pixels, so
+// the vector versions are used for 1, 2 and 4 channels only.
+
+#if qDNGHasSSE2
+
+template <uint32 kSampleSize>
+DNG_ALWAYS_INLINE __m128i AddSamplesSSE2 (__m128i a, __m128i b)
+	{
+	
+	return kSampleSize == 1 ? _mm_add_epi8  (a, b) :
+		   kSampleSize == 2 ? _mm_add_epi16 (a, b) :
+							  _mm_add_epi32 (a, b);
+	
+	}
+
+/******************************************************************************/
+
+// Running sums over the samples of a vector that are kStride bytes apart.
+
+template <uint32 kSampleSize, uint32 kStride>
+DNG_ALWAYS_INLINE __m128i ScanSSE2 (__m128i x)
+	{
+	
+	if (kStride < 16)
+		x = AddSamplesSSE2<kSampleSize> (x, _mm_slli_si128 (x, kStride < 16 ? kStride : 0));
+	
+	if (kStride * 2 < 16)
+		x = AddSamplesSSE2<kSampleSize> (x, _mm_slli_si128 (x, kStride * 2 < 16 ? kStride * 2 : 0));
+	
+	if (kStride * 4 < 16)
+		x = AddSamplesSSE2<kSampleSize> (x, _mm_slli_si128 (x, kStride * 4 < 16 ? kStride * 4 : 0));
+	
+	if (kStride * 8 < 16)
+		x = AddSamplesSSE2<kSampleSize> (x, _mm_slli_si128 (x, kStride * 8 < 16 ? kStride * 8 : 0));
+	
+	return x;
+	
+	}
+
+/******************************************************************************/
+
+// Repeats the last kStride bytes of a vector over the whole vector.
+
+template <uint32 kStride>
+DNG_ALWAYS_INLINE __m128i RepeatLastSSE2 (__m128i x)
+	{
+	
+	x = _mm_srli_si128 (x, 16 - kStride);
+	
+	if (kStride < 16)
+		x = _mm_or_si128 (x, _mm_slli_si128 (x, kStride < 16 ? kStride : 0));
+	
+	if (kStride * 2 < 16)
+		x = _mm_or_si128 (x, _mm_slli_si128 (x, kStride * 2 < 16 ? kStride * 2 : 0));
+	
+	if (kStride * 4 < 16)
+		x = _mm_or_si128 (x, _mm_slli_si128 (x, kStride * 4 < 16 ? kStride * 4 : 0));
+	
+	if (kStride * 8 < 16)
+		x = _mm_or_si128 (x, _mm_slli_si128 (x, kStride * 8 < 16 ? kStride * 8 : 0));
+	
+	return x;
+	
+	}
+
+/******************************************************************************/
+
+template <typename T, uint32 kChannels>
+static void DecodeDeltaRowSSE2 (T *dPtr,
+								uint32 count)
+	{
+	
+	const uint32 kStride = kChannels * (uint32) sizeof (T);
+	const uint32 kVectorSamples = 16 / (uint32) sizeof (T);
+	
+	__m128i sum = _mm_setzero_si128 ();
+	
+	uint32 index = 0;
+	
+	for (; index + kVectorSamples <= count; index += kVectorSamples)
+		{
+		
+		__m128i x = _mm_loadu_si128 ((const __m128i *) (dPtr + index));
+		
+		x = ScanSSE2<sizeof (T), kStride> (x);
+		
+		_mm_storeu_si128 ((__m128i *) (dPtr + index),
+						  AddSamplesSSE2<sizeof (T)> (x, sum));
+		
+		sum = AddSamplesSSE2<sizeof (T)> (sum, RepeatLastSSE2<kStride> (x));
+		
+		}
+		
+	for (index = Max_uint32 (index, kChannels); index < count; index++)
+		{
+		
+		dPtr [index] += dPtr [index - kChannels];
+		
+		}
+	
+	}
+
+#endif	// qDNGHasSSE2
+
+/******************************************************************************/
+
+#if qDNGHasAVX2
+
+// The AVX2 shifts work on each 128 bit half of the vector separately, so the
+// halves are summed like SSE2 vectors, and the sum of the lower half is then
+// added to the upper half.
+
+template <uint32 kSampleSize>
+DNG_TARGET_AVX2 inline __m256i AddSamplesAVX2 (__m256i a, __m256i b)
+	{
+	
+	return kSampleSize == 1 ? _mm256_add_epi8  (a, b) :
+		   kSampleSize == 2 ? _mm256_add_epi16 (a, b) :
+							  _mm256_add_epi32 (a, b);
+	
+	}
+
+/******************************************************************************/
+
+template <uint32 kSampleSize, uint32 kStride>
+DNG_TARGET_AVX2 inline __m256i ScanHalvesAVX2 (__m256i x)
+	{
+	
+	if (kStride < 16)
+		x = AddSamplesAVX2<kSampleSize> (x, _mm256_slli_si256 (x, kStride < 16 ? kStride : 0));
+	
+	if (kStride * 2 < 16)
+		x = AddSamplesAVX2<kSampleSize> (x, _mm256_slli_si256 (x, kStride * 2 < 16 ? kStride * 2 : 0));
+	
+	if (kStride * 4 < 16)
+		x = AddSamplesAVX2<kSampleSize> (x, _mm256_slli_si256 (x, kStride * 4 < 16 ? kStride * 4 : 0));
+	
+	if (kStride * 8 < 16)
+		x = AddSamplesAVX2<kSampleSize> (x, _mm256_slli_si256 (x, kStride * 8 < 16 ? kStride * 8 : 0));
+	
+	return x;
+	
+	}
+
+/******************************************************************************/
+
+template <uint32 kStride>
+DNG_TARGET_AVX2 inline __m256i RepeatLastOfHalvesAVX2 (__m256i x)
+	{
+	
+	x = _mm256_srli_si256 (x, 16 - kStride);
+	
+	if (kStride < 16)
+		x = _mm256_or_si256 (x, _mm256_slli_si256 (x, kStride < 16 ? kStride : 0));
+	
+	if (kStride * 2 < 16)
+		x = _mm256_or_si256 (x, _mm256_slli_si256 (x, kStride * 2 < 16 ? kStride * 2 : 0));
+	
+	if (kStride * 4 < 16)
+		x = _mm256_or_si256 (x, _mm256_slli_si256 (x, kStride * 4 < 16 ? kStride * 4 : 0));
+	
+	if (kStride * 8 < 16)
+		x = _mm256_or_si256 (x, _mm256_slli_si256 (x, kStride * 8 < 16 ? kStride * 8 : 0));
+	
+	return x;
+	
+	}
+
+/******************************************************************************/
+
+template <typename T, uint32 kChannels>
+DNG_TARGET_AVX2 static void DecodeDeltaRowAVX2 (T *dPtr,
+												uint32 count)
+	{
+	
+	const uint32 kStride = kChannels * (uint32) sizeof (T);
+	const uint32 kVectorSamples = 32 / (uint32) sizeof (T);
+	
+	__m256i sum = _mm256_setzero_si256 ();
+	
+	uint32 index = 0;
+	
+	for (; index + kVectorSamples <= count; index += kVectorSamples)
+		{
+		
+		__m256i x = _mm256_loadu_si256 ((const __m256i *) (dPtr + index));
+		
+		x = ScanHalvesAVX2<sizeof (T), kStride> (x);
+		
+		__m256i last = RepeatLastOfHalvesAVX2<kStride> (x);
+		
+		// Lower half: zero, upper half: last samples of the lower half.
+		
+		x = AddSamplesAVX2<sizeof (T)> (x, _mm256_permute2x128_si256 (last, last, 0x08));
+		
+		_mm256_storeu_si256 ((__m256i *) (dPtr + index),
+							 AddSamplesAVX2<sizeof (T)> (x, sum));
+		
+		sum = AddSamplesAVX2<sizeof (T)> (sum, _mm256_permute2x128_si256 (last, last, 0x00));
+		sum = AddSamplesAVX2<sizeof (T)> (sum, _mm256_permute2x128_si256 (last, last, 0x11));
+		
+		}
+		
+	for (index = Max_uint32 (index, kChannels); index < count; index++)
+		{
+		
+		dPtr [index] += dPtr [index - kChannels];
+		
+		}
+	
+	}
+
+#endif	// qDNGHasAVX2
+
+/******************************************************************************/
+
+#if qDNGHasNEON
+
+// vextq_u8 with a zero vector takes the place of the SSE2 byte shifts.
+
+template <uint32 kSampleSize>
+DNG_ALWAYS_INLINE uint8x16_t AddSamplesNEON (uint8x16_t a, uint8x16_t b)
+	{
+	
+	return kSampleSize == 1 ? vaddq_u8 (a, b) :
+		   kSampleSize == 2 ? vreinterpretq_u8_u16 (vaddq_u16 (vreinterpretq_u16_u8 (a),
+															   vreinterpretq_u16_u8 (b))) :
+							  vreinterpretq_u8_u32 (vaddq_u32 (vreinterpretq_u32_u8 (a),
+															   vreinterpretq_u32_u8 (b)));
+	
+	}
+
+/******************************************************************************/
+
+// Shifts the bytes of x up by kShift positions.
+
+template <uint32 kShift>
+DNG_ALWAYS_INLINE uint8x16_t ShiftUpNEON (uint8x16_t x)
+	{
+	
+	return vextq_u8 (vdupq_n_u8 (0), x, kShift < 16 ? 16 - kShift : 0);
+	
+	}
+
+/******************************************************************************/
+
+template <uint32 kSampleSize, uint32 kStride>
+DNG_ALWAYS_INLINE uint8x16_t ScanNEON (uint8x16_t x)
+	{
+	
+	if (kStride < 16)
+		x = AddSamplesNEON<kSampleSize> (x, ShiftUpNEON<kStride> (x));
+	
+	if (kStride * 2 < 16)
+		x = AddSamplesNEON<kSampleSize> (x, ShiftUpNEON<kStride * 2> (x));
+	
+	if (kStride * 4 < 16)
+		x = AddSamplesNEON<kSampleSize> (x, ShiftUpNEON<kStride * 4> (x));
+	
+	if (kStride * 8 < 16)
+		x = AddSamplesNEON<kSampleSize> (x, ShiftUpNEON<kStride * 8> (x));
+	
+	return x;
+	
+	}
+
+/******************************************************************************/
+
+template <uint32 kStride>
+DNG_ALWAYS_INLINE uint8x16_t RepeatLastNEON (uint8x16_t x)
+	{
+	
+	x = vextq_u8 (x, vdupq_n_u8 (0), kStride < 16 ? 16 - kStride : 0);
+	
+	if (kStride < 16)
+		x = vorrq_u8 (x, ShiftUpNEON<kStride> (x));
+	
+	if (kStride * 2 < 16)
+		x = vorrq_u8 (x, ShiftUpNEON<kStride * 2> (x));
+	
+	if (kStride * 4 < 16)
+		x = vorrq_u8 (x, ShiftUpNEON<kStride * 4> (x));
+	
+	if (kStride * 8 < 16)
+		x = vorrq_u8 (x, ShiftUpNEON<kStride * 8> (x));
+	
+	return x;
+	
+	}
+
+/******************************************************************************/
+
+template <typename T, uint32 kChannels>
+static void DecodeDeltaRowNEON (T *dPtr,
+								uint32 count)
+	{
+	
+	const uint32 kStride = kChannels * (uint32) sizeof (T);
+	const uint32 kVectorSamples = 16 / (uint32) sizeof (T);
+	
+	uint8x16_t sum = vdupq_n_u8 (0);
+	
+	uint32 index = 0;
+	
+	for (; index + kVectorSamples <= count; index += kVectorSamples)
+		{
+		
+		uint8x16_t x = vld1q_u8 ((const uint8 *) (dPtr + index));
+		
+		x = ScanNEON<sizeof (T), kStride> (x);
+		
+		vst1q_u8 ((uint8 *) (dPtr + index),
+				  AddSamplesNEON<sizeof (T)> (x, sum));
+		
+		sum = AddSamplesNEON<sizeof (T)> (sum, RepeatLastNEON<kStride> (x));
+		
+		}
+		
+	for (index = Max_uint32 (index, kChannels); index < count; index++)
+		{
+		
+		dPtr [index] += dPtr [index - kChannels];
+		
+		}
+	
+	}
+
+#endif	// qDNGHasNEON
+
+/******************************************************************************/
+
+// Decodes the rows with the best vector version the CPU supports. Returns false
+// if there is none for the channel count, the caller decodes the rows then.
+
+template <typename T>
+static bool DecodeDeltaSIMD (T *dPtr,
+							 uint32 rows,
+							 uint32 cols,
+							 uint32 channels)
+	{
+	
+	if (channels != 1 && channels != 2 && channels != 4)
+		{
+		return false;
+		}
+	
+	void (*decodeRow) (T *, uint32) = NULL;
+	
+	#if qDNGHasAVX2
+	
+	if (gDNGMaxSIMD >= AVX2)
+		{
+		
+		decodeRow = channels == 1 ? DecodeDeltaRowAVX2<T, 1> :
+					channels == 2 ? DecodeDeltaRowAVX2<T, 2> :
+									DecodeDeltaRowAVX2<T, 4>;
+		
+		}
+		
+	else
+	
+	#endif
+	
+	#if qDNGHasSSE2
+	
+	if (gDNGMaxSIMD >= SSE2)
+		{
+		
+		decodeRow = channels == 1 ? DecodeDeltaRowSSE2<T, 1> :
+					channels == 2 ? DecodeDeltaRowSSE2<T, 2> :
+									DecodeDeltaRowSSE2<T, 4>;
+		
+		}
+	
+	#endif
+	
+	#if qDNGHasNEON
+	
+	if (gDNGMaxSIMD >= arm64_neon)
+		{
+		
+		decodeRow = channels == 1 ? DecodeDeltaRowNEON<T, 1> :
+					channels == 2 ? DecodeDeltaRowNEON<T, 2> :
+									DecodeDeltaRowNEON<T, 4>;
+		
+		}
+	
+	#endif
+	
+	if (!decodeRow)
+		{
+		return false;
+		}
+	
+	const uint32 dRowStep = cols * channels;
+	
+	for (uint32 row = 0; row < rows; row++)
+		{
+		
+		decodeRow (dPtr, dRowStep);
+		
+		dPtr += dRowStep;
+		
+		}
+		
+	return true;
+	
+	}
+
+/******************************************************************************/
+
 static void DecodeDelta8 (uint8 *dPtr,
 						  uint32 rows,
 						  uint32 cols,
 						  uint32 channels)
 	{
 	
+	// Burst Photo modified (added): use the vector version, if there is one.
+	
+	if (DecodeDeltaSIMD (dPtr, rows, cols, channels))
+		{
+		return;
+		}
+	
 	const uint32 dRowStep = cols * channels;
 	
 	for (uint32 row = 0; row < rows; row++)
@@ -76,6 +498,13 @@ static void DecodeDelta16 (uint16 *dPtr,
 						   uint32 channels)
 	{
 	
+	// Burst Photo modified (added): use the vector version, if there is one.
+	
+	if (DecodeDeltaSIMD (dPtr, rows, cols, channels))
+		{
+		return;
+		}
+	
 	const uint32 dRowStep = cols * channels;
 	
 	for (uint32 row = 0; row < rows; row++)
@@ -107,6 +536,13 @@ static void DecodeDelta32 (uint32 *dPtr,
 						   uint32 channels)
 	{
 	
+	// Burst Photo modified (added): use the vector version, if there is one.
+	
+	if (DecodeDeltaSIMD (dPtr, rows, cols, channels))
+		{
+		return;
+		}
+	
 	const uint32 dRowStep = cols * channels;
 	
 	for (uint32 row = 0; row < rows; row++)
@@ -135,6 +571,13 @@ static void DecodeDelta32 (uint32 *dPtr,
 inline void DecodeDeltaBytes (uint8 *bytePtr, int32 cols, int32 channels)
 	{
 	
+	// Burst Photo modified (added): use the vector version, if there is one.
+	
+	if (DecodeDeltaSIMD (bytePtr, 1, (uint32) cols, (uint32) channels))
+		{
+		return;
+		}
+	
 	if (channels == 1)
 		{
 		
@@ -233,6 +676,154 @@ inline void DecodeDeltaBytes (uint8 *bytePtr, int32 cols, int32 channels)
 							
 /*****************************************************************************/
 
+// Burst Photo modified (added): vector versions of the interleaving of the
+// byte planes of a floating point row. They return the number of samples that
+// were interleaved, the caller interleaves the rest. The interleaving is bound
+// by memory bandwidth, so there are no AVX2 versions.
+
+static int32 InterleaveBytes2SIMD (const uint8 *input0,
+								   const uint8 *input1,
+								   uint8 *output,
+								   int32 count)
+	{
+	
+	int32 col = 0;
+	
+	#if qDNGHasSSE2
+	
+	if (gDNGMaxSIMD >= SSE2)
+		{
+		
+		for (; col + 16 <= count; col += 16)
+			{
+			
+			__m128i b0 = _mm_loadu_si128 ((const __m128i *) (input0 + col));
+			__m128i b1 = _mm_loadu_si128 ((const __m128i *) (input1 + col));
+			
+			_mm_storeu_si128 ((__m128i *) (output     ), _mm_unpacklo_epi8 (b0, b1));
+			_mm_storeu_si128 ((__m128i *) (output + 16), _mm_unpackhi_epi8 (b0, b1));
+			
+			output += 32;
+			
+			}
+		
+		}
+	
+	#elif qDNGHasNEON
+	
+	if (gDNGMaxSIMD >= arm64_neon)
+		{
+		
+		for (; col + 16 <= count; col += 16)
+			{
+			
+			uint8x16x2_t b;
+			
+			b.val [0] = vld1q_u8 (input0 + col);
+			b.val [1] = vld1q_u8 (input1 + col);
+			
+			vst2q_u8 (output, b);
+			
+			output += 32;
+			
+			}
+		
+		}
+	
+	#else
+	
+	(void) input0;
+	(void) input1;
+	(void) output;
+	(void) count;
+	
+	#endif
+	
+	return col;
+	
+	}
+
+/*****************************************************************************/
+
+static int32 InterleaveBytes4SIMD (const uint8 *input0,
+								   const uint8 *input1,
+								   const uint8 *input2,
+								   const uint8 *input3,
+								   uint8 *output,
+								   int32 count)
+	{
+	
+	int32 col = 0;
+	
+	#if qDNGHasSSE2
+	
+	if (gDNGMaxSIMD >= SSE2)
+		{
+		
+		for (; col + 16 <= count; col += 16)
+			{
+			
+			__m128i b0 = _mm_loadu_si128 ((const __m128i *) (input0 + col));
+			__m128i b1 = _mm_loadu_si128 ((const __m128i *) (input1 + col));
+			__m128i b2 = _mm_loadu_si128 ((const __m128i *) (input2 + col));
+			__m128i b3 = _mm_loadu_si128 ((const __m128i *) (input3 + col));
+			
+			__m128i b01lo = _mm_unpacklo_epi8 (b0, b1);
+			__m128i b01hi = _mm_unpackhi_epi8 (b0, b1);
+			__m128i b23lo = _mm_unpacklo_epi8 (b2, b3);
+			__m128i b23hi = _mm_unpackhi_epi8 (b2, b3);
+			
+			_mm_storeu_si128 ((__m128i *) (output     ), _mm_unpacklo_epi16 (b01lo, b23lo));
+			_mm_storeu_si128 ((__m128i *) (output + 16), _mm_unpackhi_epi16 (b01lo, b23lo));
+			_mm_storeu_si128 ((__m128i *) (output + 32), _mm_unpacklo_epi16 (b01hi, b23hi));
+			_mm_storeu_si128 ((__m128i *) (output + 48), _mm_unpackhi_epi16 (b01hi, b23hi));
+			
+			output += 64;
+			
+			}
+		
+		}
+	
+	#elif qDNGHasNEON
+	
+	if (gDNGMaxSIMD >= arm64_neon)
+		{
+		
+		for (; col + 16 <= count; col += 16)
+			{
+			
+			uint8x16x4_t b;
+			
+			b.val [0] = vld1q_u8 (input0 + col);
+			b.val [1] = vld1q_u8 (input1 + col);
+			b.val [2] = vld1q_u8 (input2 + col);
+			b.val [3] = vld1q_u8 (input3 + col);
+			
+			vst4q_u8 (output, b);
+			
+			output += 64;
+			
+			}
+		
+		}
+	
+	#else
+	
+	(void) input0;
+	(void) input1;
+	(void) input2;
+	(void) input3;
+	(void) output;
+	(void) count;
+	
+	#endif
+	
+	return col;
+	
+	}
+
+/*****************************************************************************/
+
 static void DecodeFPDelta (uint8 *input,
 						   uint8 *output,
 						   int32 cols,
@@ -255,7 +846,13 @@ static void DecodeFPDelta (uint8 *input,
 		const uint8 *input0 = input + rowIncrement;
 		#endif
 		
-		for (int32 col = 0; col < rowIncrement; ++col)
+		// Burst Photo modified: interleave whole vectors first.
+		
+		int32 col = InterleaveBytes2SIMD (input0, input1, output, rowIncrement);
+		
+		output += col * 2;
+		
+		for (; col < rowIncrement; ++col)
 			{
 			
 			output [0] = input0 [col];
@@ -302,7 +899,13 @@ static void DecodeFPDelta (uint8 *input,
 		const uint8 *input0 = input + rowIncrement * 3;
 		#endif
 		
-		for (int32 col = 0; col < rowIncrement; ++col)
+		// Burst Photo modified: interleave whole vectors first.
+		
+		int32 col = InterleaveBytes4SIMD (input0, input1, input2, input3, output, rowIncrement);
+		
+		output += col * 4;
+		
+		for (; col < rowIncrement; ++col)
 			{
 			
 			output [0] = input0 [col];
@@ -1211,6 +1814,52 @@ bool dng_read_image::ReadUncompressed (dng_host &host,
 	
 	uint32 pixelType = ttUndefined;
 	
+	// Burst Photo modified: if the stream is available in memory (e.g. a
+	// memory-mapped file) and the samples are stored in native byte order
+	// without further processing, pass the stored samples to the image
+	// directly instead of copying them to the uncompressed buffer first.
+	
+	const uint8 *streamData = (const uint8 *) stream.Data ();
+	
+	if (streamData != NULL &&
+		ifd.fSampleFormat [0] != sfFloatingPoint &&
+		ifd.fSampleBitShift == 0 &&
+		ifd.fSubTileBlockRows <= 1 &&
+		(bitDepth == 8 || ((bitDepth == 16 || bitDepth == 32) && !stream.SwapBytes ())))
+		{
+		
+		uint32 sampleSize = bitDepth >> 3;
+		
+		uint64 tileBytes = (uint64) samplesPerTile * sampleSize;
+		
+		const uint8 *tileData = streamData + stream.Position ();
+		
+		if (stream.Position () + tileBytes <= stream.Length () &&
+			((uintptr) tileData) % sampleSize == 0)
+			{
+			
+			pixelType = bitDepth == 8  ? (uint32) ttByte  :
+						bitDepth == 16 ? (uint32) ttShort : image.PixelType ();
+			
+			// The buffer is only read from.
+			
+			dng_pixel_buffer buffer (tileArea, 
+									 plane, 
+									 planes, 
+									 pixelType,
+									 ifd.fPlanarConfiguration, 
+									 (void *) tileData);
+			
+			stream.Skip (tileBytes);
+									 
+			image.Put (buffer);
+			
+			return true;
+			
+			}
+		
+		}
+	
 	if (bitDepth == 8)
 		{
 		
@@ -1890,12 +2539,16 @@ bool dng_read_image::ReadLosslessJPEG (dng_host &host,
 	
 	uint64 tileOffset = stream.Position ();
 
+	// Burst Photo modified: the host is passed on, so that a large tile can
+	// be decoded on several threads of the host.
+
 	DoDecodeLosslessJPEG (stream,
 						  spooler,
 						  decodedSize.Get (),
 						  decodedSize.Get (),
 						  bug16,
-						  tileOffset + tileByteCount);
+						  tileOffset + tileByteCount,
+						  &host);
 
 	return true;
 	
@@ -2191,6 +2844,12 @@ void dng_read_image::ReadTile (dng_host &host,
 							   bool usingMultipleThreads)
 	{
 	
+	// Burst Photo modified: count the tile and the time it takes to decode
+	// it, if the host has counters.
+	
+	dng_perf_tile_scope perfScope (host.PerfCounters (),
+								   tileByteCount);
+	
 	switch (ifd.fCompression)
 		{
 		
@@ -2789,12 +3448,33 @@ void dng_read_tiles_task::Process (uint32 /* threadIndex */,
 		{
 		uncompressedBuffer.Reset (fHost.Allocate (fUncompressedSize));
 		}
+		
+	// Burst Photo modified: if the whole stream is available in memory (e.g.
+	// a memory-mapped file), tiles that are decoded through a stream are read
+	// in place, without copying them to the compressed buffer while holding
+	// the mutex.
+	
+	const uint8 *streamData = (const uint8 *) fStream.Data ();
+	
+	bool readInPlace = streamData != NULL &&
+					   fJPEGImage == NULL &&
+					   fJPEGTileDigest == NULL &&
+					   (fIFD.fCompression == ccUncompressed ||
+						(fIFD.fCompression == ccJPEG && !fIFD.IsBaselineJPEG ()));
+						
+	// Burst Photo modified: if the stream supports positional reads from
+	// several threads, the mutex only guards the tile index and the tiles
+	// are read concurrently.
+	
+	bool readConcurrently = fStream.SupportsConcurrentReads ();
 
 	while (true)
 		{
 
 		uint32 tileIndex;
 		uint32 byteCount;
+		
+		const void *tileData;
 
 			{
 
@@ -2806,15 +3486,47 @@ void dng_read_tiles_task::Process (uint32 /* threadIndex */,
 				}
 
 			tileIndex = fNextTileIndex++;
+			
+			if (!readInPlace && !readConcurrently)
+				{
 
-			ReadTask (tileIndex,
-					  byteCount,
-					  compressedBuffer.Get ());
+				ReadTask (tileIndex,
+						  byteCount,
+						  compressedBuffer.Get ());
+						  
+				}
 
 			}
+			
+		if (readInPlace)
+			{
+			
+			byteCount = fTileByteCount [tileIndex];
+			
+			tileData = streamData + fTileOffset [tileIndex];
+			
+			}
+			
+		else
+			{
+			
+			if (readConcurrently)
+				{
+				
+				ReadTask (tileIndex,
+						  byteCount,
+						  compressedBuffer.Get ());
+						  
+				}
+			
+			tileData = fJPEGImage ? fJPEGImage->fJPEGData [tileIndex]->Buffer ()
+								  : compressedBuffer->Buffer ();
+								  
+			}
 
 		ProcessTask (tileIndex,
 					 byteCount,
+					 tileData,
 					 sniffer,
 					 compressedBuffer,
 					 uncompressedBuffer,
@@ -2831,10 +3543,6 @@ void dng_read_tiles_task::ReadTask (uint32 tileIndex,
 									dng_memory_block *compressedBuffer)
 	{
 	
-	TempStreamSniffer noSniffer (fStream, NULL);
-
-	fStream.SetReadPosition (fTileOffset [tileIndex]);
-
 	byteCount = fTileByteCount [tileIndex];
 
 	if (fJPEGImage)
@@ -2843,9 +3551,29 @@ void dng_read_tiles_task::ReadTask (uint32 tileIndex,
 		fJPEGImage->fJPEGData [tileIndex] . Reset (fHost.Allocate (byteCount));
 
 		}
+		
+	void *data = fJPEGImage ? fJPEGImage->fJPEGData [tileIndex]->Buffer ()
+							: compressedBuffer->Buffer ();
+		
+	// Burst Photo modified: positional reads do not touch the read position
+	// or the buffer of the stream, so they do not need the mutex.
+		
+	if (fStream.SupportsConcurrentReads ())
+		{
+		
+		fStream.ReadAt (data,
+						byteCount,
+						fTileOffset [tileIndex]);
+						
+		return;
+		
+		}
+	
+	TempStreamSniffer noSniffer (fStream, NULL);
 
-	fStream.Get (fJPEGImage ? fJPEGImage->fJPEGData [tileIndex]->Buffer ()
-							: compressedBuffer->Buffer (),
+	fStream.SetReadPosition (fTileOffset [tileIndex]);
+
+	fStream.Get (data,
 				 byteCount);	
 
 	}
@@ -2854,6 +3582,7 @@ void dng_read_tiles_task::ReadTask (uint32 tileIndex,
 
 void dng_read_tiles_task::ProcessTask (uint32 tileIndex,
 									   uint32 byteCount,
+									   const void *tileData,
 									   dng_abort_sniffer *sniffer,
 									   AutoPtr<dng_memory_block> &compressedBuffer,
 									   AutoPtr<dng_memory_block> &uncompressedBuffer,
@@ -2874,8 +3603,7 @@ void dng_read_tiles_task::ProcessTask (uint32 tileIndex,
 
 		}
 
-	dng_stream tileStream (fJPEGImage ? fJPEGImage->fJPEGData [tileIndex]->Buffer ()
-									  : compressedBuffer->Buffer (),
+	dng_stream tileStream (tileData,
 						   byteCount);
 
 	tileStream.SetLittleEndian (fStream.LittleEndian ());
@@ -2890,6 +3618,11 @@ void dng_read_tiles_task::ProcessTask (uint32 tileIndex,
 
 	dng_host host (&fHost.Allocator (),
 				   sniffer);				// Cannot use sniffer attached to main host
+				   
+	// Burst Photo modified: tiles are counted with the counters of the main
+	// host.
+	
+	host.SetPerfCounters (fHost.PerfCounters ());
 
 	fReadImage.ReadTile (host,
 						 fIFD,
@@ -3326,6 +4059,14 @@ void dng_read_image::Read (dng_host &host,
 											  tileOffset [0],
 											  contiguousByteCount);
 		
+	// Burst Photo modified: let the stream know which byte ranges will be
+	// read, if the tile sizes are known.
+	
+	dng_stream_tile_read_hint tileReadHint (stream,
+											tileByteCount ? tileCount : 0,
+											tileOffset,
+											tileByteCount);
+		
 	// See if we can do this read using multiple threads.
 	
 	bool useMultipleThreads = (outerSamples * tilesDown * tilesAcross >= 2) &&
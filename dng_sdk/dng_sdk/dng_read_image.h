@@ -249,6 +249,7 @@ class dng_read_tiles_task : public dng_area_task,
 
 		void ProcessTask (uint32 tileIndex,
 						  uint32 byteCount,
+						  const void *tileData,		// Burst Photo modified (added)
 						  dng_abort_sniffer *sniffer,
 						  AutoPtr<dng_memory_block> &compressedBuffer,
 						  AutoPtr<dng_memory_block> &uncompressedBuffer,
@@ -752,9 +752,9 @@ class dng_render_task: public dng_filter_task
 		AutoPtr<dng_1d_table> fLookTableEncode;
 		AutoPtr<dng_1d_table> fLookTableDecode;
 	
-		AutoPtr<dng_memory_block> fTempBuffer [kMaxMPThreads];
+		AutoArray<AutoPtr<dng_memory_block> > fTempBuffer;
   
-		AutoPtr<dng_memory_block> fMaskBuffer [kMaxMPThreads];
+		AutoArray<AutoPtr<dng_memory_block> > fMaskBuffer;
 		
 	public:
 	
@@ -1014,6 +1014,8 @@ void dng_render_task::Start (uint32 threadCount,
 		
 		}
 	
+	fTempBuffer.Reset (threadCount);
+	
 	for (uint32 threadIndex = 0; threadIndex < threadCount; threadIndex++)
 		{
 		
@@ -1036,6 +1038,8 @@ void dng_render_task::Start (uint32 threadCount,
 			
 			}
 	
+		fMaskBuffer.Reset (threadCount);
+	
 		for (uint32 threadIndex = 0; threadIndex < threadCount; threadIndex++)
 			{
 			
@@ -72,6 +72,9 @@ const uint32 kMaxImageSide = 65000;
 const uint32 kMaxToneCurvePoints = 8192;
 
 /// Maximum number of MP threads for dng_area_task operations.
+/// Burst Photo modified: no longer limits the number of threads. The SDK
+/// tasks allocate their per-thread buffers for the thread count they are
+/// started with, and kMaxMPThreads is only kept for source compatibility.
 
 #if qDNG64Bit
 const uint32 kMaxMPThreads = 128; // EP! Needs much larger max!
@@ -21,6 +21,38 @@
 
 /*****************************************************************************/
 
+// Burst Photo modified (added): intrinsics for code that is written for an
+// instruction set directly. SSE2 and NEON are part of the 64 bit x86 and arm
+// architectures. AVX2 code is compiled with a target attribute instead of a
+// compiler option and must only be called if gDNGMaxSIMD >= AVX2.
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define qDNGHasSSE2 1
+#include <immintrin.h>
+#else
+#define qDNGHasSSE2 0
+#endif
+
+#if qDNGHasSSE2 && (defined(__GNUC__) || defined(__clang__))
+#define qDNGHasAVX2 1
+#define DNG_TARGET_AVX2 __attribute__((target ("avx2")))
+#elif qDNGHasSSE2 && defined(_MSC_VER)
+#define qDNGHasAVX2 1
+#define DNG_TARGET_AVX2
+#else
+#define qDNGHasAVX2 0
+#define DNG_TARGET_AVX2
+#endif
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#define qDNGHasNEON 1
+#include <arm_neon.h>
+#else
+#define qDNGHasNEON 0
+#endif
+
+/*****************************************************************************/
+
 enum SIMDType
 	{
 
@@ -364,6 +364,55 @@ void dng_stream::Get (void *data, uint32 count, uint32 maxOverRead)
 		
 /*****************************************************************************/
 
+bool dng_stream::SupportsConcurrentReads () const
+	{
+	
+	// Reading from a stream that is entirely in memory does not change it.
+	
+	return Data () != NULL;
+	
+	}
+		
+/*****************************************************************************/
+
+void dng_stream::ReadAt (void *data, uint32 count, uint64 offset)
+	{
+	
+	const uint8 *streamData = (const uint8 *) Data ();
+	
+	if (streamData)
+		{
+		
+		if (offset + count > fLength)
+			{
+			
+			ThrowEndOfFile ();
+			
+			}
+			
+		memcpy (data, streamData + offset, count);
+		
+		return;
+		
+		}
+		
+	DoReadAt (data, count, offset);
+	
+	}
+		
+/*****************************************************************************/
+
+void dng_stream::DoReadAt (void * /* data */,
+						   uint32 /* count */,
+						   uint64 /* offset */)
+	{
+	
+	ThrowProgramError ();
+	
+	}
+		
+/*****************************************************************************/
+
 void dng_stream::SetWritePosition (uint64 offset)
 	{
 	
@@ -95,6 +95,12 @@ class dng_stream: private dng_uncopyable
 							  uint32 count,
 							  uint64 offset);
 		
+		// Burst Photo modified (added)
+		
+		virtual void DoReadAt (void *data,
+							   uint32 count,
+							   uint64 offset);
+		
 	public:
 	
 		/// Construct a stream with initial data.
@@ -244,6 +250,42 @@ class dng_stream: private dng_uncopyable
 		/// if not enough data in stream.
 		
 		void Get (void *data, uint32 count, uint32 maxOverRead=0);
+		
+		/// Burst Photo modified (added): Returns true if ReadAt can be called
+		/// from several threads at the same time.
+		
+		virtual bool SupportsConcurrentReads () const;
+		
+		/// Burst Photo modified (added): Get data from an absolute offset in
+		/// the stream without using or changing the read position and the
+		/// buffer of the stream. Data that has been written to the stream but
+		/// not flushed yet is not seen.
+		/// \param data Buffer to put data into. Must be valid for count bytes.
+		/// \param count Bytes of data to read.
+		/// \param offset Offset of the data from the start of the stream.
+		/// \exception dng_exception if not enough data available in stream.
+		
+		void ReadAt (void *data, uint32 count, uint64 offset);
+		
+		/// Burst Photo modified (added): Called before the tiles of an image
+		/// are read from the stream, so that streams can fetch them ahead of
+		/// time. The arrays are only valid until EndTileReads is called.
+		/// \param tileCount Number of tiles.
+		/// \param tileOffset Offset of each tile in the stream.
+		/// \param tileByteCount Size of each tile in bytes.
+		
+		virtual void BeginTileReads (uint32 /* tileCount */,
+									 const uint64 * /* tileOffset */,
+									 const uint32 * /* tileByteCount */)
+			{
+			}
+			
+		/// Burst Photo modified (added): Called after the tiles announced
+		/// with BeginTileReads have been read.
+		
+		virtual void EndTileReads ()
+			{
+			}
 
 		/// Seek to a new position in stream for writing.
 		
@@ -692,6 +734,37 @@ class dng_stream_contiguous_read_hint
 
 /*****************************************************************************/
 
+// Burst Photo modified (added)
+
+class dng_stream_tile_read_hint: private dng_uncopyable
+	{
+	
+	private:
+	
+		dng_stream &fStream;
+		
+	public:
+	
+		dng_stream_tile_read_hint (dng_stream &stream,
+								   uint32 tileCount,
+								   const uint64 *tileOffset,
+								   const uint32 *tileByteCount)
+								   
+			:	fStream (stream)
+			
+			{
+			fStream.BeginTileReads (tileCount, tileOffset, tileByteCount);
+			}
+			
+		~dng_stream_tile_read_hint ()
+			{
+			fStream.EndTileReads ();
+			}
+	
+	};
+
+/*****************************************************************************/
+
 class TempBigEndian
 	{
 	